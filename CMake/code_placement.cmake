@@ -0,0 +1,188 @@
+# Places the RAM_CODE(function) candidates in RAM or flash, see compiler.h.
+#
+# CODE_PLACEMENT
+#   MANUAL   every candidate runs from RAM (the old behaviour)
+#   FLASH    every candidate stays in flash, nRF52 runs it from the instruction cache
+#   PROFILE  candidates go to RAM only where that is cheaper per advertising event
+#
+# The profile has one line per function: name, size in bytes and instructions executed per
+# advertising event, e.g. from a simulator or an instruction trace. Sizes come from
+# `arm-none-eabi-nm --size-sort -S` on a FLASH build. Lines starting with # are ignored.
+#
+#   ble_send_on_channel 64 38
+#
+# Running from RAM saves CPU current for every instruction, but the bytes have to be copied
+# at startup, take RAM from heap and stack and that RAM has to be retained while sleeping.
+# Candidates are taken by their net saving per byte until CODE_RAM_BUDGET is used up.
+
+set(CODE_PLACEMENT "MANUAL" CACHE STRING "Placement of RAM_CODE functions, MANUAL (all in RAM), FLASH or PROFILE (cheapest for CODE_PROFILE)")
+set_property(CACHE CODE_PLACEMENT PROPERTY STRINGS MANUAL FLASH PROFILE)
+set(CODE_PROFILE "${CMAKE_CURRENT_SOURCE_DIR}/code_profile.txt" CACHE FILEPATH "Instruction profile for CODE_PLACEMENT=PROFILE")
+set(CODE_RAM_BUDGET "1024" CACHE STRING "Bytes of RAM CODE_PLACEMENT=PROFILE may use for code")
+set(CODE_PROFILE_INTERVAL "1" CACHE STRING "Seconds between two advertising events the profile was taken with")
+
+# Datasheet values, retention is a rough estimate
+if(NRF5_TARGET_FAMILY STREQUAL "nrf51")
+  set(code_mhz 16)
+  set(code_flash_ua 4100)
+  set(code_ram_ua 2400)
+  set(code_retention_na 600)        # Per 8KB block
+  set(code_section_bytes 8192)
+else()
+  set(code_mhz 64)
+  set(code_flash_ua 3700)           # Instruction cache on
+  set(code_ram_ua 3300)
+  set(code_retention_na 30)         # Per 4KB section
+  set(code_section_bytes 4096)
+endif()
+set(code_copy_cycles_per_word 5)    # Copy loop of the startup code
+
+# Charge in pC as nC with three decimals
+function(code_format_nc pc out)
+  math(EXPR whole "${pc} / 1000")
+  math(EXPR frac "${pc} % 1000")
+  string(LENGTH "${frac}" frac_length)
+  if(frac_length EQUAL 1)
+    set(frac "00${frac}")
+  elseif(frac_length EQUAL 2)
+    set(frac "0${frac}")
+  endif()
+  set(${out} "${whole}.${frac}" PARENT_SCOPE)
+endfunction()
+
+# RAM bytes, startup copy time and charge per advertising event of one placement
+function(code_report name ram_functions)
+  set(bytes 0)
+  set(pc 0)
+  foreach(function ${code_candidates})
+    if(NOT DEFINED code_bytes_${function})
+      continue()
+    endif()
+
+    if(function IN_LIST ram_functions)
+      math(EXPR bytes "${bytes} + ${code_bytes_${function}}")
+      math(EXPR pc "${pc} + ${code_ram_pc_${function}}")
+    else()
+      math(EXPR pc "${pc} + ${code_flash_pc_${function}}")
+    endif()
+  endforeach()
+
+  math(EXPR copy_us "(${bytes} / 4) * ${code_copy_cycles_per_word} / ${code_mhz}")
+  code_format_nc(${pc} nc)
+  message(STATUS "  ${name}: ${bytes} bytes RAM, ${copy_us} us startup copy, ${nc} nC per advert")
+endfunction()
+
+function(code_placement target)
+  if(NOT CODE_PLACEMENT MATCHES "^(MANUAL|FLASH|PROFILE)$")
+    message(FATAL_ERROR "Unknown CODE_PLACEMENT ${CODE_PLACEMENT}, use MANUAL, FLASH or PROFILE")
+  endif()
+  message(STATUS "Code placement: ${CODE_PLACEMENT}")
+
+  if(CODE_PLACEMENT STREQUAL "FLASH")
+    target_compile_definitions(${target} PRIVATE "CODE_PLACEMENT_FLASH")
+  endif()
+  if(NOT CODE_PLACEMENT STREQUAL "PROFILE")
+    return()
+  endif()
+
+  if(NOT EXISTS "${CODE_PROFILE}")
+    message(FATAL_ERROR "CODE_PLACEMENT=PROFILE needs a profile, ${CODE_PROFILE} does not exist")
+  endif()
+
+  # Every function marked in the sources, the profile may be missing some
+  file(GLOB sources "${CMAKE_CURRENT_SOURCE_DIR}/src/*.c")
+  set(code_candidates "")
+  foreach(source ${sources})
+    file(STRINGS "${source}" lines REGEX "^RAM_CODE\\([A-Za-z0-9_]+\\)")
+    foreach(line ${lines})
+      string(REGEX REPLACE "^RAM_CODE\\(([A-Za-z0-9_]+)\\).*" "\\1" function "${line}")
+      list(APPEND code_candidates ${function})
+    endforeach()
+  endforeach()
+  list(REMOVE_DUPLICATES code_candidates)
+
+  file(STRINGS "${CODE_PROFILE}" profile_lines)
+  foreach(line ${profile_lines})
+    if(line MATCHES "^[ \t]*(#|$)")
+      continue()
+    endif()
+    if(NOT line MATCHES "^[ \t]*([A-Za-z0-9_]+)[ \t]+([0-9]+)[ \t]+([0-9]+)[ \t]*$")
+      message(FATAL_ERROR "Broken line in ${CODE_PROFILE}: ${line}")
+    endif()
+
+    set(function ${CMAKE_MATCH_1})
+    set(bytes ${CMAKE_MATCH_2})
+    set(instructions ${CMAKE_MATCH_3})
+    if(NOT function IN_LIST code_candidates)
+      message(WARNING "${function} in ${CODE_PROFILE} is not marked RAM_CODE, ignoring it")
+      continue()
+    endif()
+
+    # uA times us is pC
+    math(EXPR flash_pc "${instructions} * ${code_flash_ua} / ${code_mhz}")
+    math(EXPR retention_pc "${bytes} * ${code_retention_na} * ${CODE_PROFILE_INTERVAL} * 1000 / ${code_section_bytes}")
+    math(EXPR ram_pc "${instructions} * ${code_ram_ua} / ${code_mhz} + ${retention_pc}")
+    set(code_bytes_${function} ${bytes})
+    set(code_flash_pc_${function} ${flash_pc})
+    set(code_ram_pc_${function} ${ram_pc})
+  endforeach()
+
+  # Rank by net saving per byte, zero padded so the string sort works
+  set(ranking "")
+  set(missing "")
+  foreach(function ${code_candidates})
+    if(NOT DEFINED code_bytes_${function})
+      list(APPEND missing ${function})
+      continue()
+    endif()
+
+    math(EXPR saving "${code_flash_pc_${function}} - ${code_ram_pc_${function}}")
+    if(saving GREATER 0 AND code_bytes_${function} GREATER 0)
+      math(EXPR density "${saving} * 1000 / ${code_bytes_${function}}")
+      string(LENGTH "${density}" density_length)
+      while(density_length LESS 12)
+        set(density "0${density}")
+        math(EXPR density_length "${density_length} + 1")
+      endwhile()
+      list(APPEND ranking "${density}:${function}")
+    endif()
+  endforeach()
+  list(SORT ranking)
+  list(REVERSE ranking)
+
+  if(missing)
+    string(REPLACE ";" ", " missing "${missing}")
+    message(WARNING "Not in ${CODE_PROFILE}, kept in flash: ${missing}")
+  endif()
+
+  set(used 0)
+  set(ram_functions "")
+  foreach(entry ${ranking})
+    string(REGEX REPLACE "^[0-9]+:" "" function "${entry}")
+    math(EXPR next "${used} + ${code_bytes_${function}}")
+    if(next LESS_EQUAL CODE_RAM_BUDGET)
+      set(used ${next})
+      list(APPEND ram_functions ${function})
+    endif()
+  endforeach()
+
+  set(CODE_PLACEMENT_DEFINES "")
+  foreach(function ${code_candidates})
+    if(function IN_LIST ram_functions)
+      string(APPEND CODE_PLACEMENT_DEFINES "#define CODE_PLACE_${function} RAM_CODE_ATTRIBUTE\n")
+    else()
+      string(APPEND CODE_PLACEMENT_DEFINES "#define CODE_PLACE_${function}\n")
+    endif()
+  endforeach()
+  configure_file("${CMAKE_CURRENT_SOURCE_DIR}/src/code_placement.h.in" "${CMAKE_CURRENT_BINARY_DIR}/src/code_placement.h" @ONLY)
+  set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS "${CODE_PROFILE}")
+
+  list(LENGTH ram_functions ram_count)
+  list(LENGTH code_candidates candidate_count)
+  message(STATUS "Code placement: ${ram_count} of ${candidate_count} functions in RAM (${used} of ${CODE_RAM_BUDGET} bytes)")
+  code_report("FLASH  " "")
+  code_report("MANUAL " "${code_candidates}")
+  code_report("PROFILE" "${ram_functions}")
+
+  target_compile_definitions(${target} PRIVATE "CODE_PLACEMENT_PROFILE")
+endfunction()
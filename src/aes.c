@@ -1,71 +1,150 @@
 #include "nrf.h"
 #include "aes.h"
 #include "timer.h"
+#include "energy.h"
+#include "trace.h"
+#include "isr_timing.h"
 #include "compiler.h"
 
 #include <string.h>
-#include <stdlib.h>
 
-#ifdef LOG
-#include "rtt/SEGGER_RTT.h"
-#endif
+#define LOG_MODULE AES
 
+/**
+ * @brief One ECB job. The first 48 bytes are the layout ECBDATAPTR expects
+ * (key, cleartext, ciphertext), so a job can be handed to the peripheral as is.
+ */
 typedef struct {
     uint8_t key[16];
     uint8_t clear[16];
     uint8_t encrypted[16];
-} ecb_data;
+    void (*cb)(uint8_t encrypted[16]);
+} ecb_job;
 
-static void (*onECBDoneCB)(uint8_t encrypted[16]);
+static ecb_job jobs[AES_QUEUE_SIZE];
+static uint8_t jobs_head = 0;                       // Job currently owned by the peripheral
+static uint8_t jobs_count = 0;
+static bool aborted = false;                        // Head job lost the AES core, waits for aes_resume()
+
+static void aes_start_head(void)
+{
+    NRF_ECB->ECBDATAPTR = (uint32_t) &jobs[jobs_head];
+    NRF_ECB->TASKS_STARTECB = 1;
+    ENERGY_START(ENERGY_ECB);
+}
 
 void ECB_IRQHandler(void)
 {
-    #ifdef LOG
-    SEGGER_RTT_printf(0, "%u> AES: Interrupt\r\n", timer_get_seconds());
-    #endif
+    ISR_TIMING_ENTER(ISR_ECB);
+    TRACE_EVENT(TRACE_AES_IRQ, 0, 0);
+
+    if (NRF_ECB->EVENTS_ERRORECB)
+    {
+        NRF_ECB->EVENTS_ERRORECB = 0;
+
+        // CCM or AAR took the AES core. Restarting right away only gets aborted again for as long
+        // as they run, the head job waits for aes_resume() instead
+        aborted = true;
+        ENERGY_STOP(ENERGY_ECB);
+
+        TRACE_EVENT(TRACE_AES_ABORTED, jobs_count, 0);
+    }
 
     if (NRF_ECB->EVENTS_ENDECB)
     {
         NRF_ECB->EVENTS_ENDECB = 0;
 
-        // Get the data out of the struct
-        ecb_data* data = (ecb_data *) NRF_ECB->ECBDATAPTR;
-        onECBDoneCB(data->encrypted);
-        onECBDoneCB = NULL;
-        free(data);
+        // Take the finished job out of the queue. The result is copied since the
+        // callback may queue a new job which can reuse the slot we just freed
+        ecb_job* job = &jobs[jobs_head];
+        void (*cb)(uint8_t encrypted[16]) = job->cb;
+        uint8_t encrypted[16];
+        memcpy(encrypted, job->encrypted, 16);
+
+        jobs_head = (jobs_head + 1) % AES_QUEUE_SIZE;
+        jobs_count--;
+
+        // Chain straight into the next job while the clock is still running
+        if (jobs_count > 0)
+        {
+            aes_start_head();
+        }
+        else
+        {
+            ENERGY_STOP(ENERGY_ECB);
+        }
+
+        if (cb != NULL)
+        {
+            cb(encrypted);
+        }
     }
+
+    ISR_TIMING_EXIT(ISR_ECB);
 }
 
 void aes_init(void)
 {
     NVIC_DisableIRQ(ECB_IRQn);
 
-    NRF_ECB->INTENSET = ECB_INTENSET_ENDECB_Msk;
+    jobs_head = 0;
+    jobs_count = 0;
+    aborted = false;
+
+    NRF_ECB->INTENSET = ECB_INTENSET_ENDECB_Msk | ECB_INTENSET_ERRORECB_Msk;
 
     NVIC_ClearPendingIRQ(ECB_IRQn);
     NVIC_EnableIRQ(ECB_IRQn);
     NVIC_SetPriority(ECB_IRQn, 0);
 }
 
-void aes_encrypt(uint8_t key[16], uint8_t iv[16], uint8_t data[16], void (*cb)(uint8_t encrypted[16]))
+bool aes_encrypt(uint8_t key[16], uint8_t iv[16], uint8_t data[16], void (*cb)(uint8_t encrypted[16]))
 {
-    onECBDoneCB = cb;
+    // The queue is also touched from the ECB interrupt
+    NVIC_DisableIRQ(ECB_IRQn);
+
+    if (jobs_count == AES_QUEUE_SIZE)
+    {
+        NVIC_EnableIRQ(ECB_IRQn);
+
+        TRACE_EVENT(TRACE_AES_FULL, 0, 0);
 
-    // Allocate ECB data struct
-    ecb_data* data_ecb;
-    data_ecb = (ecb_data*) malloc(sizeof(ecb_data));
-    memcpy(data_ecb->key, key, 16);
+        return false;
+    }
+
+    ecb_job* job = &jobs[(jobs_head + jobs_count) % AES_QUEUE_SIZE];
+    memcpy(job->key, key, 16);
+    job->cb = cb;
 
     // Since we only have ECB in hardware we "emulate" CCM by XOR IV and data
     for(uint8_t i = 0; i < 16; i++)
     {
-        data_ecb->clear[i] = data[i] ^ iv[i];
+        job->clear[i] = (iv != NULL) ? (data[i] ^ iv[i]) : data[i];
     }
 
-    NRF_ECB->ECBDATAPTR = (uint32_t) data_ecb;
-    NRF_ECB->TASKS_STARTECB = 1;
+    // Only kick the peripheral if it is idle, otherwise the interrupt or aes_resume() picks the job up
+    jobs_count++;
+    if (jobs_count == 1)
+    {
+        aes_start_head();
+    }
+
+    NVIC_EnableIRQ(ECB_IRQn);
+
+    TRACE_EVENT(TRACE_AES_QUEUED, jobs_count, 0);
+
+    return true;
+}
 
-    #ifdef LOG
-    SEGGER_RTT_printf(0, "%u> AES: Start encryption\r\n", timer_get_seconds());
-    #endif
-}
\ No newline at end of file
+void aes_resume(void)
+{
+    NVIC_DisableIRQ(ECB_IRQn);
+
+    if (aborted)
+    {
+        aborted = false;
+        aes_start_head();
+    }
+
+    NVIC_EnableIRQ(ECB_IRQn);
+}
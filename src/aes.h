@@ -1,7 +1,26 @@
 #ifndef DOOR_AES_H__
 #define DOOR_AES_H__
 
+#include <stdint.h>
+#include <stdbool.h>
+
+/// Number of ECB jobs which can be queued at the same time
+#define AES_QUEUE_SIZE  4
+
 void aes_init(void);
-void aes_encrypt(uint8_t key[16], uint8_t iv[16], uint8_t data[16], void (*cb)(uint8_t encrypted[16]));
 
-#endif
\ No newline at end of file
+/**
+ * @brief Queue an encryption of data XOR iv with the given key. Jobs run back to back in the
+ * order they were queued, each one reports its own result to its callback. Pass NULL as iv for plain ECB.
+ *
+ * @return false when the job queue is full and nothing was queued
+ */
+bool aes_encrypt(uint8_t key[16], uint8_t iv[16], uint8_t data[16], void (*cb)(uint8_t encrypted[16]));
+
+/**
+ * @brief Restart the job ECB had to abort because CCM or AAR used the AES core. Call it once
+ * they are done, does nothing when no job was aborted.
+ */
+void aes_resume(void);
+
+#endif
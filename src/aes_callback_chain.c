@@ -5,82 +5,350 @@
 #include "ble.h"
 #include "timer.h"
 #include "aes.h"
+#include "ccm.h"
+#include "keystream.h"
+#include "payload.h"
+#include "kv.h"
+#include "epoch.h"
 #include "reboot_counter.h"
+#include "trace.h"
 #include "compiler.h"
 
 #include <string.h>
-#include <stdlib.h>
 
-#ifdef LOG
-#include "rtt/SEGGER_RTT.h"
-#endif
+#define LOG_MODULE AES
 
-#define IV_OFFSET 7
 #define IV_LENGTH 8
 
-static void (*aes_timerEventDoneCB)();        // CB which should be called when BLE data is done to reschedule timer
-static uint8_t aes_timer_slot;
-static uint8_t* iv_data;
+#if defined(PAYLOAD_MODE_CCM)
+static void aes_ccm_counter_init(void);
+#endif
 
-void on_aes_encrypted(uint8_t encrypted[16])
+void aes_callback_chain_init()
 {
-  uint8_t* adv_pdu = ble_get_adv_pdu();
+  // Identity comes from the store, the build time values are only used to provision it
+  if (!kv_get(KV_KEY_DEVICE_KEY, DEVICE_KEY, sizeof(DEVICE_KEY)))
+  {
+    kv_set(KV_KEY_DEVICE_KEY, DEVICE_KEY, sizeof(DEVICE_KEY));
+  }
+
+  if (!kv_get(KV_KEY_DEVICE_ID, DEVICE_ID, sizeof(DEVICE_ID)))
+  {
+    kv_set(KV_KEY_DEVICE_ID, DEVICE_ID, sizeof(DEVICE_ID));
+  }
+
+  #if defined(PAYLOAD_MODE_CTR)
+  keystream_init();
+  #elif defined(PAYLOAD_MODE_CCM)
+  aes_ccm_counter_init();
+  #endif
+}
+
+#if !defined(PAYLOAD_MODE_CCM)
+
+/**
+ * @brief Fill the 16 byte plaintext block of the legacy and the CTR payload
+ */
+static void aes_fill_plaintext(uint8_t data[16], uint16_t reboot_counter, uint32_t time)
+{
+  memcpy(data, DEVICE_ID, 10);
+
+  data[10] = ((reboot_counter >> 8) & 0xFF);
+  data[11] = (reboot_counter & 0xFF);
+
+  data[12] = ((time >> 24) & 0xFF);
+  data[13] = ((time >> 16) & 0xFF);
+  data[14] = ((time >> 8) & 0xFF);
+  data[15] = (time & 0xFF);
+}
 
-  // Copy IV and free the generated IV directly after
-  memcpy(&adv_pdu[3 + M_BD_ADDR_SIZE + IV_OFFSET], iv_data, IV_LENGTH);
-  free(iv_data);
+#endif
+
+#if defined(PAYLOAD_MODE_CTR)
 
-  // Copy encrypted data over to adv
-  memcpy(&adv_pdu[3 + M_BD_ADDR_SIZE + IV_OFFSET + IV_LENGTH], encrypted, 16);
+static void aes_keystream_refill(void)
+{
+  if (!keystream_low())
+  {
+    return;
+  }
 
-  // Call timer callback if present, it can be missing when manually called on boot
-  if (aes_timerEventDoneCB != NULL)
+  uint8_t iv[KEYSTREAM_SIZE * KEYSTREAM_IV_LENGTH];
+  if (!random_fill(iv, sizeof(iv)))
   {
-    aes_timerEventDoneCB(aes_timer_slot);
+    return;
   }
+
+  keystream_refill(DEVICE_KEY, iv);
 }
 
-void aes_callback_chain(void (*doneCB)())
+RAM_CODE(aes_callback_chain_prepare) void aes_callback_chain_prepare(void)
 {
-  aes_timerEventDoneCB = doneCB;
+  keystream_def keystream;
+  if (!keystream_take(&keystream))
+  {
+    TRACE_EVENT(TRACE_AES_CB_NO_KEYSTREAM, 0, 0);
 
-  #ifdef LOG
-  SEGGER_RTT_printf(0, "%u> AES CB: Got AES encrypt timer event\r\n", timer_get_seconds());
-  #endif
+    return;
+  }
 
-  // Generate IV
-  uint8_t iv[16];
-  iv_data = random_get();
-  memcpy(&iv, iv_data, 8);
-  memcpy(&iv[8], iv_data, 8);
+  // The keystream was computed ahead, so the payload is just an XOR with the current time
+  uint32_t time = epoch_get();
+  uint8_t data[16];
+  aes_fill_plaintext(data, (uint16_t) reboot_counter_get(), time);
 
-  #ifdef LOG
-  SEGGER_RTT_printf(0, "%u> AES CB: Generated new IV: 0x%2.2x, 0x%2.2x, 0x%2.2x, 0x%2.2x, 0x%2.2x, 0x%2.2x, 0x%2.2x, 0x%2.2x\r\n", timer_get_seconds(), iv[0], iv[1], iv[2], iv[3], iv[4], iv[5], iv[6], iv[7]);
-  #endif
+  uint8_t payload[PAYLOAD_LENGTH];
+  payload[0] = PAYLOAD_VERSION;
+  memcpy(&payload[1], keystream.nonce, KEYSTREAM_NONCE_LENGTH);
+  for(uint8_t i = 0; i < 16; i++)
+  {
+    payload[1 + KEYSTREAM_NONCE_LENGTH + i] = data[i] ^ keystream.block[i];
+  }
+
+  payload_push(time, payload);
+}
+
+RAM_CODE(aes_callback_chain_radio_window) void aes_callback_chain_radio_window(void)
+{
+  // HFCLK is running for the radio anyway, compute the next blocks now
+  aes_keystream_refill();
+}
+
+void aes_callback_chain_issue()
+{
+  // The keystream is ready long before the timer fires, so the first advert can go out right away
+  aes_keystream_refill();
+  ble_callback_chain_kick();
+}
+
+#else
+
+static uint8_t iv_data[PAYLOAD_BATCH_SIZE * IV_LENGTH];   // IVs of the running batch, IV_LENGTH bytes for every payload
+static bool batch_running = false;
+static uint32_t batch_time;                   // Timestamp of the first payload in the running batch
+static uint8_t batch_size;                    // Number of payloads in the running batch
+static uint8_t batch_queued;                  // Number of payloads handed to the ECB
+static uint8_t batch_done;                    // Number of payloads which came back from the ECB
+static bool first_payload = false;            // A payload was encrypted since boot
+
+static void aes_batch_finish(void)
+{
+  batch_running = false;
+}
+
+static void aes_batch_queue(void);
+
+static void on_payload_encrypted(uint8_t payload[PAYLOAD_LENGTH])
+{
+  // Jobs finish in the order they were queued
+  payload_push(batch_time + (batch_done * ble_callback_chain_interval()), payload);
+  batch_done++;
+
+  // Very first payload after boot, no need to wait for the interval to send it
+  if (!first_payload)
+  {
+    first_payload = true;
+    ble_callback_chain_kick();
+  }
+
+  if (batch_done == batch_size)
+  {
+    TRACE_EVENT(TRACE_AES_CB_DONE, batch_size, 0);
+
+    aes_batch_finish();
+    return;
+  }
+
+  aes_batch_queue();
+}
+
+#if defined(PAYLOAD_MODE_CCM)
+
+#define CCM_COUNTER_LEASE 4096                // Packet counter values reserved in the key/value store ahead
+
+static uint32_t ccm_counter = 0;              // Packet counter of the CCM nonce, never goes back, not even across reboots
+static uint32_t ccm_reserved = 0;             // Counter values covered by the key/value store
+
+/*
+ * The timestamp alone does not keep nonces apart, a batch after a reset can cover the same
+ * seconds again. So the packet counter is leased like the epoch and resumes after a reset
+ * from a value past everything it handed out before.
+ */
+
+static void aes_ccm_counter_reserve(void)
+{
+  ccm_reserved = ccm_counter + CCM_COUNTER_LEASE;
+  kv_set(KV_KEY_CCM_COUNTER, &ccm_reserved, sizeof(ccm_reserved));
+}
+
+static void aes_ccm_counter_init(void)
+{
+  if (!kv_get(KV_KEY_CCM_COUNTER, &ccm_counter, sizeof(ccm_counter)))
+  {
+    ccm_counter = 0;
+  }
+
+  // A reset before the lease is in flash would hand out the same values again
+  aes_ccm_counter_reserve();
+  kv_commit();
+}
+
+void on_ccm_encrypted(uint8_t* encrypted, uint8_t length)
+{
+  uint8_t payload[PAYLOAD_LENGTH];
+  payload[0] = PAYLOAD_VERSION;
+  payload[1] = ((ccm_counter >> 24) & 0xFF);
+  payload[2] = ((ccm_counter >> 16) & 0xFF);
+  payload[3] = ((ccm_counter >> 8) & 0xFF);
+  payload[4] = (ccm_counter & 0xFF);
+  memcpy(&payload[5], &iv_data[batch_done * IV_LENGTH], IV_LENGTH);
+  memcpy(&payload[5 + IV_LENGTH], encrypted, length);
+
+  ccm_counter++;
+
+  // Staged here, it goes to flash with the next kv_flush() long before the lease runs out
+  if (ccm_counter + (CCM_COUNTER_LEASE / 2) >= ccm_reserved)
+  {
+    aes_ccm_counter_reserve();
+  }
+
+  on_payload_encrypted(payload);
+}
+
+static bool aes_batch_encrypt(uint8_t* iv, uint16_t reboot_counter, uint32_t time)
+{
+  // The MIC proves the frame came from the key owner, so the device id does not need to be sent
+  uint8_t data[6];
+  data[0] = ((reboot_counter >> 8) & 0xFF);
+  data[1] = (reboot_counter & 0xFF);
+  data[2] = ((time >> 24) & 0xFF);
+  data[3] = ((time >> 16) & 0xFF);
+  data[4] = ((time >> 8) & 0xFF);
+  data[5] = (time & 0xFF);
+
+  // Values past the reservation could come again after a reset
+  if (ccm_counter >= ccm_reserved)
+  {
+    return false;
+  }
+
+  return ccm_encrypt(DEVICE_KEY, ccm_counter, iv, data, sizeof(data), on_ccm_encrypted);
+}
+
+#else
+
+void on_aes_encrypted(uint8_t encrypted[16])
+{
+  uint8_t payload[PAYLOAD_LENGTH];
+  memcpy(payload, &iv_data[batch_done * IV_LENGTH], IV_LENGTH);
+  memcpy(&payload[IV_LENGTH], encrypted, 16);
+
+  on_payload_encrypted(payload);
+}
+
+static bool aes_batch_encrypt(uint8_t* iv_part, uint16_t reboot_counter, uint32_t time)
+{
+  // The IV is doubled to fill the whole block
+  uint8_t iv[16];
+  memcpy(&iv, iv_part, IV_LENGTH);
+  memcpy(&iv[8], iv_part, IV_LENGTH);
 
-  // Encrypt new value
   uint8_t data[16];
-  memcpy(&data, DEVICE_ID, 10);
+  aes_fill_plaintext(data, reboot_counter, time);
 
+  return aes_encrypt(DEVICE_KEY, iv, data, on_aes_encrypted);
+}
+
+#endif
+
+static void aes_batch_queue(void)
+{
   uint16_t reboot_counter = (uint16_t) reboot_counter_get();
-  data[10] = ((reboot_counter >> 8) & 0xFF); 
-  data[11] = (reboot_counter & 0xFF); 
 
-  uint32_t time = timer_get_seconds();
-  data[12] = ((time >> 24) & 0xFF); 
-  data[13] = ((time >> 16) & 0xFF); 
-  data[14] = ((time >> 8) & 0xFF); 
-  data[15] = (time & 0xFF); 
+  while (batch_queued < batch_size)
+  {
+    // Every payload carries the time it is going to be advertised at
+    uint32_t time = batch_time + (batch_queued * ble_callback_chain_interval());
+    if (!aes_batch_encrypt(&iv_data[batch_queued * IV_LENGTH], reboot_counter, time))
+    {
+      break;
+    }
+
+    batch_queued++;
+  }
 
-  aes_encrypt(DEVICE_KEY, iv, data, on_aes_encrypted);
+  // Nothing in flight means nothing will call us back, so stop with what we have
+  if (batch_queued == batch_done)
+  {
+    TRACE_EVENT(TRACE_AES_CB_BUSY, batch_done, 0);
+
+    aes_batch_finish();
+  }
 }
 
-void aes_callback_chain_issue()
+static void aes_batch_start(void)
 {
-    aes_callback_chain(NULL);
+  // Previous batch is still running, it already fills the ring
+  if (batch_running)
+  {
+    return;
+  }
+
+  // Continue right after the payloads which are still waiting, outdated ones get pushed out of the ring
+  uint32_t now = epoch_get();
+  batch_time = now;
+  batch_size = PAYLOAD_BATCH_SIZE;
+  if (payload_count() > 0 && payload_last_time() >= now)
+  {
+    batch_time = payload_last_time() + ble_callback_chain_interval();
+    batch_size = PAYLOAD_BATCH_SIZE - payload_count();
+  }
+
+  // Only take as many IVs as the pool has, the rest follows with the next advert
+  if (batch_size > random_available() / IV_LENGTH)
+  {
+    batch_size = random_available() / IV_LENGTH;
+  }
+
+  // Nothing to take, just make sure the pool fills up for the next advert
+  if (batch_size == 0)
+  {
+    random_refill();
+    return;
+  }
+
+  if (!random_fill(iv_data, batch_size * IV_LENGTH))
+  {
+    return;
+  }
+
+  batch_running = true;
+  batch_queued = 0;
+  batch_done = 0;
+
+  TRACE_EVENT(TRACE_AES_CB_BATCH, batch_size, batch_time);
+
+  aes_batch_queue();
+}
+
+RAM_CODE(aes_callback_chain_prepare) void aes_callback_chain_prepare(void)
+{
+  // Payloads were encrypted ahead, nothing to do right before the advert
+}
+
+RAM_CODE(aes_callback_chain_radio_window) void aes_callback_chain_radio_window(void)
+{
+  // HFCLK is running for the radio anyway, so top up the ring now. The new
+  // payloads are ready long before the next advertising event swaps them in
+  if (payload_count() <= PAYLOAD_WATERMARK)
+  {
+    aes_batch_start();
+  }
 }
 
-void aes_callback_chain_register()
+void aes_callback_chain_issue()
 {
-    aes_timer_slot = timer_add(aes_callback_chain, 30);
-}
\ No newline at end of file
+    aes_batch_start();
+}
+
+#endif
@@ -3,7 +3,24 @@
 
 #include <stdint.h>
 
-void aes_callback_chain_register();
+/**
+ * @brief Load the device key and ident from the key/value store
+ */
+void aes_callback_chain_init();
+
+/**
+ * @brief Encrypt the first payloads right away, used once random data is available after boot
+ */
 void aes_callback_chain_issue();
 
+/**
+ * @brief Called at the start of every advertising event, right before the payload is swapped in
+ */
+void aes_callback_chain_prepare(void);
+
+/**
+ * @brief Called while HFCLK is running for an advertising event, so encryption work costs no extra clock start
+ */
+void aes_callback_chain_radio_window(void);
+
 #endif
@@ -0,0 +1,184 @@
+#include "nrf.h"
+#include "battery.h"
+#include "ble.h"
+#include "ble_callback_chain.h"
+#include "idle.h"
+#include "timer.h"
+#include "trace.h"
+#include "compiler.h"
+
+#define LOG_MODULE POWER
+
+/*
+ * VDD is sampled rarely and only while an advertising event runs, so HFCLK is up anyway and
+ * the value is taken under radio load, which is the voltage the cell actually has to hold.
+ * The sample is evaluated from the idle loop, the policy then stretches the advertising
+ * interval and caps the TX power.
+ */
+
+typedef struct {
+    uint16_t min_mv;                // Lowest VDD for this level
+    uint8_t interval_scale;         // Multiplier for the configured advertising interval
+    int8_t max_tx_power;            // TX power cap in dBm
+} battery_policy_def;
+
+static const battery_policy_def policies[] = {
+    { 2800, 1, 8 },                 // Fresh cell, configured interval and power
+    { 2500, 2, 0 },
+    { 2300, 4, -8 },
+    { 0,    8, -12 },               // Low battery, keeps the tag visible as long as possible
+};
+
+#define POLICY_COUNT    (sizeof(policies) / sizeof(policies[0]))
+
+static uint16_t vdd_mv = 0;
+static uint8_t level = 0;
+static uint32_t events = 0;
+
+static void battery_apply_policy(void)
+{
+    uint8_t next = level;
+
+    // Going down needs VDD below the level, going back up needs the hysteresis on top
+    while (next < POLICY_COUNT - 1 && vdd_mv < policies[next].min_mv)
+    {
+        next++;
+    }
+    while (next > 0 && vdd_mv >= policies[next - 1].min_mv + BATTERY_HYSTERESIS_MV)
+    {
+        next--;
+    }
+
+    if (next == level)
+    {
+        return;
+    }
+
+    level = next;
+    ble_set_tx_power_limit(policies[level].max_tx_power);
+    ble_callback_chain_set_interval_scale(BLE_SCALE_BATTERY, policies[level].interval_scale);
+
+    TRACE_EVENT(TRACE_BATTERY_LEVEL, vdd_mv, level);
+}
+
+#if !defined(SAADC_PRESENT)
+
+// nRF51 and the nRF52820 have no SAADC
+static const struct {
+    uint32_t threshold;
+    uint16_t mv;
+} pof_thresholds[] = {
+    { POWER_POFCON_THRESHOLD_V27, 2700 },
+    { POWER_POFCON_THRESHOLD_V25, 2500 },
+    { POWER_POFCON_THRESHOLD_V23, 2300 },
+    { POWER_POFCON_THRESHOLD_V21, 2100 },
+};
+
+static void battery_sample(void)
+{
+    // No ADC input for VDD here, so walk down the power fail comparator thresholds instead
+    vdd_mv = 0;
+    for (uint8_t i = 0; i < sizeof(pof_thresholds) / sizeof(pof_thresholds[0]); i++)
+    {
+        NRF_POWER->EVENTS_POFWARN = 0;
+        NRF_POWER->POFCON = (POWER_POFCON_POF_Enabled << POWER_POFCON_POF_Pos)
+                          | (pof_thresholds[i].threshold << POWER_POFCON_THRESHOLD_Pos);
+
+        // Give the comparator time to settle
+        for (volatile uint8_t wait = 0; wait < 50; wait++);
+
+        if (NRF_POWER->EVENTS_POFWARN == 0)
+        {
+            vdd_mv = pof_thresholds[i].mv;
+            break;
+        }
+    }
+
+    NRF_POWER->POFCON = POWER_POFCON_POF_Disabled << POWER_POFCON_POF_Pos;
+    NRF_POWER->EVENTS_POFWARN = 0;
+
+    idle_defer(battery_apply_policy);
+}
+
+void battery_init(void)
+{
+}
+
+#else
+
+static volatile int16_t sample;     // Written by the SAADC through EasyDMA
+
+void SAADC_IRQHandler(void)
+{
+    if (NRF_SAADC->EVENTS_END)
+    {
+        NRF_SAADC->EVENTS_END = 0;
+
+        // Disabled between samples, an enabled SAADC keeps drawing current
+        NRF_SAADC->TASKS_STOP = 1;
+        NRF_SAADC->ENABLE = SAADC_ENABLE_ENABLE_Disabled << SAADC_ENABLE_ENABLE_Pos;
+
+        // Gain 1/6 against the 0.6V reference gives 3.6V full scale over 10 bits
+        vdd_mv = (sample > 0) ? (uint16_t) (((uint32_t) sample * 3600) / 1024) : 0;
+
+        idle_defer(battery_apply_policy);
+    }
+}
+
+static void battery_sample(void)
+{
+    NRF_SAADC->RESULT.PTR = (uint32_t) &sample;
+    NRF_SAADC->RESULT.MAXCNT = 1;
+    NRF_SAADC->ENABLE = SAADC_ENABLE_ENABLE_Enabled << SAADC_ENABLE_ENABLE_Pos;
+
+    NRF_SAADC->EVENTS_STARTED = 0;
+    NRF_SAADC->TASKS_START = 1;
+    while (NRF_SAADC->EVENTS_STARTED == 0);
+    NRF_SAADC->EVENTS_STARTED = 0;
+
+    NRF_SAADC->TASKS_SAMPLE = 1;
+}
+
+void battery_init(void)
+{
+    NVIC_DisableIRQ(SAADC_IRQn);
+
+    NRF_SAADC->RESOLUTION = SAADC_RESOLUTION_VAL_10bit;
+    NRF_SAADC->CH[0].PSELP = SAADC_CH_PSELP_PSELP_VDD;
+    NRF_SAADC->CH[0].PSELN = SAADC_CH_PSELN_PSELN_NC;
+    NRF_SAADC->CH[0].CONFIG = (SAADC_CH_CONFIG_GAIN_Gain1_6 << SAADC_CH_CONFIG_GAIN_Pos)
+                            | (SAADC_CH_CONFIG_REFSEL_Internal << SAADC_CH_CONFIG_REFSEL_Pos)
+                            | (SAADC_CH_CONFIG_TACQ_10us << SAADC_CH_CONFIG_TACQ_Pos);
+    NRF_SAADC->INTENSET = SAADC_INTENSET_END_Msk;
+
+    NVIC_ClearPendingIRQ(SAADC_IRQn);
+    NVIC_EnableIRQ(SAADC_IRQn);
+    NVIC_SetPriority(SAADC_IRQn, 0);
+}
+
+#endif
+
+RAM_CODE(battery_radio_window) void battery_radio_window(void)
+{
+    if (events++ % BATTERY_SAMPLE_EVENTS != 0)
+    {
+        return;
+    }
+
+    battery_sample();
+}
+
+uint16_t battery_mv(void)
+{
+    return vdd_mv;
+}
+
+uint8_t battery_level(void)
+{
+    return level;
+}
+
+bool battery_low(void)
+{
+    return level == POLICY_COUNT - 1;
+}
@@ -0,0 +1,32 @@
+#ifndef DOOR_BATTERY_H__
+#define DOOR_BATTERY_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BATTERY_SAMPLE_EVENTS   600     // Advertising events between two samples, the first event always samples
+#define BATTERY_HYSTERESIS_MV   100     // Voltage has to be this far above a level before going back to it
+
+void battery_init(void);
+
+/**
+ * @brief Called while HFCLK is running for an advertising event, samples VDD every BATTERY_SAMPLE_EVENTS events
+ */
+void battery_radio_window(void);
+
+/**
+ * @brief Last sampled VDD in mV, 0 before the first sample. Without SAADC (nRF51, nRF52820) this is the highest POFCON threshold VDD is above.
+ */
+uint16_t battery_mv(void);
+
+/**
+ * @brief Index into the policy table, 0 is a fresh cell
+ */
+uint8_t battery_level(void);
+
+/**
+ * @brief Check if the battery reached the last policy level
+ */
+bool battery_low(void);
+
+#endif
@@ -1,26 +1,22 @@
 #include "nrf.h"
+#include "hal.h"
 #include "ble.h"
 #include "main.h"
+#include "energy.h"
+#include "trace.h"
+#include "isr_timing.h"
+#include "log.h"
 #include "compiler.h"
 
 #include <string.h>
 #include <stdbool.h>
 
-#ifdef LOG
-#include "timer.h"
-#include "rtt/SEGGER_RTT.h"
-#endif
+#define LOG_MODULE BLE
 
 uint8_t access_address[4] = {0xD6, 0xBE, 0x89, 0x8E};
 uint8_t seed[3] = {0x55, 0x55, 0x55};
 
 
-#ifdef NRF52820_XXAA
-#define MAX_TX_POWER    RADIO_TXPOWER_TXPOWER_Pos8dBm
-#else
-#define MAX_TX_POWER    RADIO_TXPOWER_TXPOWER_Pos4dBm  
-#endif
-
 /**@brief The maximum possible length in device discovery mode. */
 #define DD_MAX_PAYLOAD_LENGTH         (31 + 6)
 
@@ -67,16 +63,18 @@ uint8_t seed[3] = {0x55, 0x55, 0x55};
 #define BD_ADDR_OFFS                (3)     /* BLE device address offest of the beacon advertising pdu. */
 
 static void (*onDisableCB)();
+static int8_t tx_power = HAL_TX_POWER_MAX;
+static int8_t tx_power_limit = 127;                // Cap from the battery policy
 
-RAM_CODE void RADIO_IRQHandler(void)
+RAM_CODE(RADIO_IRQHandler) void RADIO_IRQHandler(void)
 {
-    #ifdef LOG
-    SEGGER_RTT_printf(0, "%u> BLE: Interrupt\r\n", timer_get_seconds());
-    #endif
+    ISR_TIMING_ENTER(ISR_RADIO);
+    TRACE_EVENT(TRACE_BLE_IRQ, 0, 0);
 
     if (NRF_RADIO->EVENTS_DISABLED) 
     {
         NRF_RADIO->EVENTS_DISABLED = 0;
+        ENERGY_STOP(ENERGY_RADIO);
 
         // We need to check if the callback is the same since it can change
         // when the callback is fired due to send calling inside a callback
@@ -87,9 +85,11 @@ RAM_CODE void RADIO_IRQHandler(void)
             onDisableCB = NULL;
         }
     }
+
+    ISR_TIMING_EXIT(ISR_RADIO);
 }
 
-RAM_CODE void ble_send_on_channel(uint8_t channel_index, uint8_t * data, void (*cb)())
+RAM_CODE(ble_send_on_channel) void ble_send_on_channel(uint8_t channel_index, uint8_t * data, void (*cb)())
 {
     onDisableCB = cb;
 
@@ -99,23 +99,22 @@ RAM_CODE void ble_send_on_channel(uint8_t channel_index, uint8_t * data, void (*
 
     // Send data
     // We only start sending when radio is disabled
-    #ifdef LOG
-    SEGGER_RTT_printf(0, "%u> BLE: Sending data on channel: ", timer_get_seconds());
-    SEGGER_RTT_printf(0, "%2.2u\r\n", channel_index);
-    #endif
+    TRACE_EVENT(TRACE_BLE_SEND, channel_index, 0);
 
     NRF_RADIO->PACKETPTR = (uint32_t) &(data[0]);
     NRF_RADIO->EVENTS_DISABLED = 0;
     NRF_RADIO->TASKS_TXEN = 1;
+    ENERGY_START(ENERGY_RADIO);
 }
 
-RAM_CODE void ble_init(void) 
+RAM_CODE(ble_init) void ble_init(void) 
 {
     NVIC_DisableIRQ(RADIO_IRQn);
 
     // Ensure that we are power reset
     NRF_RADIO->POWER = RADIO_POWER_POWER_Disabled << RADIO_POWER_POWER_Pos;
     NRF_RADIO->POWER = RADIO_POWER_POWER_Enabled << RADIO_POWER_POWER_Pos;
+    hal_radio_init();
 
     // Put in short links
     NRF_RADIO->SHORTS = DEFAULT_RADIO_SHORTS;
@@ -150,7 +149,10 @@ RAM_CODE void ble_init(void)
                          | (((uint32_t)access_address[0]) << 8) );
 
     NRF_RADIO->CRCINIT = ((uint32_t)seed[0]) | ((uint32_t)seed[1])<<8 | ((uint32_t)seed[2])<<16;
-    NRF_RADIO->TXPOWER = MAX_TX_POWER;
+    // TXPOWER takes the dBm value as two's complement
+    int8_t power = hal_radio_tx_power((tx_power < tx_power_limit) ? tx_power : tx_power_limit);
+    NRF_RADIO->TXPOWER = (uint8_t) power;
+    ENERGY_SET_TX_POWER(power);
     NRF_RADIO->INTENSET = (RADIO_INTENSET_DISABLED_Enabled << RADIO_INTENSET_DISABLED_Pos);
 
     NVIC_ClearPendingIRQ(RADIO_IRQn);
@@ -158,6 +160,16 @@ RAM_CODE void ble_init(void)
     NVIC_SetPriority(RADIO_IRQn, 0);
 }
 
+void ble_set_tx_power(int8_t dbm)
+{
+    tx_power = dbm;
+}
+
+void ble_set_tx_power_limit(int8_t dbm)
+{
+    tx_power_limit = dbm;
+}
+
 void ble_pdu_init(uint8_t* data)
 {
     // Set PDU flags
@@ -182,10 +194,8 @@ void ble_pdu_init(uint8_t* data)
         memcpy(&(data[BD_ADDR_OFFS]), &(random_bd_addr[0]), M_BD_ADDR_SIZE);
     }
     
-    #ifdef LOG
-    SEGGER_RTT_printf(0, "%u> BLE: Given advertise addr: %2.2x:%2.2x:%2.2x:%2.2x:%2.2x:%2.2x\r\n", timer_get_seconds(), 
+    LOG_INFO("BLE: Given advertise addr: %2.2x:%2.2x:%2.2x:%2.2x:%2.2x:%2.2x",
         data[BD_ADDR_OFFS], data[BD_ADDR_OFFS + 1],data[BD_ADDR_OFFS + 2], data[BD_ADDR_OFFS + 3], data[BD_ADDR_OFFS + 4], data[BD_ADDR_OFFS + 5]);
-    #endif
 
     data[1] = (data[1] == 0) ? M_BD_ADDR_SIZE : data[1];
 }
@@ -8,5 +8,7 @@
 void ble_init();
 void ble_send_on_channel(uint8_t channel_index, uint8_t * data, void (*cb)());
 void ble_pdu_init(uint8_t * data);
+void ble_set_tx_power(int8_t dbm);
+void ble_set_tx_power_limit(int8_t dbm);
 
 #endif
\ No newline at end of file
@@ -2,75 +2,240 @@
 #include "ble.h"
 #include "clock.h"
 #include "timer.h"
+#include "kv.h"
+#include "flash.h"
+#include "epoch.h"
+#include "payload.h"
+#include "aes_callback_chain.h"
+#include "aes.h"
+#include "random.h"
+#include "battery.h"
+#include "diag.h"
+#include "idle.h"
+#include "energy.h"
+#include "motion.h"
+#include "pwr_mgmt.h"
+#include "trace.h"
+#include "isr_timing.h"
+#include "log.h"
 #include "compiler.h"
 
-#ifdef LOG
-#include "rtt/SEGGER_RTT.h"
-#endif
+#define LOG_MODULE BLE
 
 static uint8_t adv_pdu[40];
+static uint8_t diag_pdu[40];
+static uint8_t* tx_pdu = adv_pdu;                   // PDU sent in the running event
+static uint32_t adv_events = 0;
 
 static void (*ble_timerEventDoneCB)();
-static uint8_t ble_timer_slot;
-
-RAM_CODE uint8_t* ble_get_adv_pdu() 
+static uint8_t ble_timer_slot = 0xF;               // 0xF until the timer is registered
+static bool kick_pending = false;                  // Kick which has to wait for the timer or the running event
+static bool event_running = false;                 // From the timer callback until the slot is rescheduled
+static uint32_t first_advert = BLE_FIRST_ADVERT_NONE;
+static uint32_t adv_interval = ADV_INTERVAL;
+static uint8_t interval_scales[BLE_SCALE_COUNT] = { 1, 1 };
+
+RAM_CODE(ble_get_adv_pdu) uint8_t* ble_get_adv_pdu() 
 {
     return &(adv_pdu);
 }
 
-RAM_CODE void reschedule_ble_data(void)
+static void ble_flash_window(void)
 {
-    #ifdef LOG
-    SEGGER_RTT_printf(0, "%u> BLE CB: HFCLK stopped. Telling timer to reschedule\r\n", timer_get_seconds());
-    #endif
+    // The next event is at least two RTC ticks away, far more than the flash budget. Only a job
+    // which waited behind others that long could find it started already, its own window follows.
+    if (!event_running)
+    {
+        // Interrupts stage values as well, the flush has to see all of them or none
+        __disable_irq();
+        epoch_checkpoint();
+        if (kv_pending())
+        {
+            kv_flush();
+        }
+        __enable_irq();
+
+        flash_run();
+    }
+
+    // Raised by finished_ble_data() even when flash_run() found nothing to do
+    power_phase_stop(POWER_PHASE_FLASH);
+}
+
+RAM_CODE(reschedule_ble_data) void reschedule_ble_data(void)
+{
+    TRACE_EVENT(TRACE_BLE_RESCHEDULE, 0, 0);
+
+    // Radio is quiet until the next event, so this is the time to write flash. The NVMC stalls the
+    // CPU, so it runs from the idle loop where the other interrupts can still get in between steps.
+    if (!idle_defer(ble_flash_window))
+    {
+        power_phase_stop(POWER_PHASE_FLASH);
+    }
 
     ble_timerEventDoneCB(ble_timer_slot);
+    event_running = false;
+
+    // A kick during the event would have been overwritten by the reschedule above
+    if (kick_pending)
+    {
+        kick_pending = false;
+        timer_trigger(ble_timer_slot);
+    }
 }
 
-RAM_CODE void finished_ble_data(void)
+RAM_CODE(finished_ble_data) void finished_ble_data(void)
 {
-    // Stop HFCLK again
+    // Flash work follows right away, hand the DC/DC over instead of stopping and starting it again
+    if (flash_busy() || kv_pending())
+    {
+        power_phase_start(POWER_PHASE_FLASH);
+    }
+
+    // Constant latency off and back to the LDO unless flash work holds it, then stop HFCLK again
+    power_phase_stop(POWER_PHASE_RADIO);
     clock_stop_hf(reschedule_ble_data);
 }
 
-RAM_CODE void send_ble_data_on_channel_39(void)
+RAM_CODE(send_ble_data_on_channel_39) void send_ble_data_on_channel_39(void)
 {
     // Send data on channel
-    ble_send_on_channel(39, adv_pdu, finished_ble_data);
+    ble_send_on_channel(39, tx_pdu, finished_ble_data);
 }
 
-RAM_CODE void send_ble_data_on_channel_38(void)
+RAM_CODE(send_ble_data_on_channel_38) void send_ble_data_on_channel_38(void)
 {
     // Send data on channel
-    ble_send_on_channel(38, adv_pdu, send_ble_data_on_channel_39);
+    ble_send_on_channel(38, tx_pdu, send_ble_data_on_channel_39);
 }
 
-RAM_CODE void send_ble_data_on_channel_37(void) 
+RAM_CODE(send_ble_data_on_channel_37) void send_ble_data_on_channel_37(void) 
 {
-    #ifdef LOG
-    SEGGER_RTT_printf(0, "%u> CORE: HFCLK started. BLE init next\r\n", timer_get_seconds());
-    #endif
+    TRACE_EVENT(TRACE_BLE_HF_READY, 0, 0);
+
+    // DC/DC for the TX current, HFXO start up ran on the LDO
+    power_phase_start(POWER_PHASE_RADIO);
 
     // Init ble
     ble_init();
 
     // Send data on channel
-    ble_send_on_channel(37, adv_pdu, send_ble_data_on_channel_38);
+    ble_send_on_channel(37, tx_pdu, send_ble_data_on_channel_38);
+
+    // Let crypto work use the clock while we are sending
+    aes_callback_chain_radio_window();
+    battery_radio_window();
 }
 
-RAM_CODE void ble_callback_chain(void (*doneCB)()) 
+RAM_CODE(ble_callback_chain) void ble_callback_chain(void (*doneCB)()) 
 {
     ble_timerEventDoneCB = doneCB;
+    event_running = true;
 
-    #ifdef LOG
-    SEGGER_RTT_printf(0, "%u> CORE: Got BLE adv timer event\r\n", timer_get_seconds());
+    TRACE_EVENT(TRACE_BLE_EVENT, 0, 0);
+
+    #ifdef MOTION
+    motion_update();
     #endif
 
+    // An ECB job aborted by CCM restarts after ENDCRYPT, at the latest it goes again here
+    aes_resume();
+
+    // Swap in the precomputed payload for this second
+    aes_callback_chain_prepare();
+    payload_apply(adv_pdu);
+
+    // Radio stays off until there is real ciphertext, but the crypto has to keep going
+    if (!payload_ready())
+    {
+        TRACE_EVENT(TRACE_BLE_SKIP, 0, 0);
+
+        aes_callback_chain_radio_window();
+        reschedule_ble_data();
+        return;
+    }
+
+    if (first_advert == BLE_FIRST_ADVERT_NONE)
+    {
+        first_advert = timer_get_boot_ms();
+
+        TRACE_EVENT(TRACE_BLE_FIRST, first_advert, 0);
+    }
+
+    // Every DIAG_INTERVAL-th advert reports the tag health instead
+    tx_pdu = adv_pdu;
+    adv_events++;
+    if (adv_events % DIAG_INTERVAL == 0)
+    {
+        diag_build(diag_pdu, adv_pdu);
+        tx_pdu = diag_pdu;
+
+        #if defined(ENERGY) && LOG_ENABLED(POWER, LOG_LEVEL_INFO)
+        idle_defer(energy_report);
+        #endif
+
+        #if LOG_ENABLED(RNG, LOG_LEVEL_INFO)
+        idle_defer(random_report);
+        #endif
+
+        #ifdef ISR_TIMING_ENABLED
+        idle_defer(isr_timing_report);
+        #endif
+    }
+
     clock_start_hf(send_ble_data_on_channel_37);
 }
 
 void ble_callback_chain_register()
 {
-    ble_timer_slot = timer_add(ble_callback_chain, 1);
+    kv_get(KV_KEY_ADV_INTERVAL, &adv_interval, sizeof(adv_interval));
+
+    int8_t tx_power;
+    if (kv_get(KV_KEY_TX_POWER, &tx_power, sizeof(tx_power)))
+    {
+        ble_set_tx_power(tx_power);
+    }
+
+    ble_timer_slot = timer_add(ble_callback_chain, ble_callback_chain_interval());
+
+    // Payload got ready before the timer was running
+    if (kick_pending)
+    {
+        kick_pending = false;
+        timer_trigger(ble_timer_slot);
+    }
+}
+
+void ble_callback_chain_kick()
+{
+    if (ble_timer_slot == 0xF || event_running)
+    {
+        kick_pending = true;
+        return;
+    }
+
+    timer_trigger(ble_timer_slot);
+}
+
+uint32_t ble_callback_chain_first_advert()
+{
+    return first_advert;
+}
+
+RAM_CODE(ble_callback_chain_interval) uint32_t ble_callback_chain_interval()
+{
+    uint32_t interval = adv_interval;
+    for (uint8_t source = 0; source < BLE_SCALE_COUNT; source++)
+    {
+        interval *= interval_scales[source];
+    }
+
+    return interval;
+}
+
+void ble_callback_chain_set_interval_scale(ble_scale_source source, uint8_t scale)
+{
+    interval_scales[source] = scale;
+    timer_set_interval(ble_timer_slot, ble_callback_chain_interval());
 }
 
@@ -3,7 +3,33 @@
 
 #include <stdint.h>
 
+#define ADV_INTERVAL    1       // Default seconds between two advertising events
+#define BLE_FIRST_ADVERT_NONE   0xFFFFFFFF
+
 void ble_callback_chain_register();
+uint32_t ble_callback_chain_interval();
+
+typedef enum {
+    BLE_SCALE_BATTERY = 0,
+    BLE_SCALE_MOTION,
+    BLE_SCALE_COUNT
+} ble_scale_source;
+
+/**
+ * @brief Stretch the configured advertising interval, the factors of all sources are multiplied
+ */
+void ble_callback_chain_set_interval_scale(ble_scale_source source, uint8_t scale);
+
+/**
+ * @brief Run the next advertising event right away instead of waiting for the interval, used once the first payload is ready
+ * and when motion starts. A kick during a running event takes effect once that event is done.
+ */
+void ble_callback_chain_kick();
+
+/**
+ * @brief Milliseconds from boot until the first advert with a valid payload, BLE_FIRST_ADVERT_NONE until then
+ */
+uint32_t ble_callback_chain_first_advert();
 uint8_t* ble_get_adv_pdu();
 
 #endif
@@ -0,0 +1,114 @@
+#include "nrf.h"
+#include "ccm.h"
+#include "aes.h"
+#include "timer.h"
+#include "energy.h"
+#include "trace.h"
+#include "compiler.h"
+
+#include <string.h>
+
+#define LOG_MODULE AES
+
+#define CCM_HEADER_LENGTH   3       // S0, LENGTH and S1 in front of every packet
+#define CCM_SCRATCH_LENGTH  43      // Scratch area needed for packets of up to 27 bytes
+
+/**
+ * @brief Data structure CNFPTR points to
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t key[16];
+    uint8_t counter[8];             // 39 bit packet counter, little endian
+    uint8_t direction;
+    uint8_t iv[8];
+} ccm_cnf;
+
+static ccm_cnf cnf;
+static uint8_t packet_in[CCM_HEADER_LENGTH + CCM_MAX_LENGTH];
+static uint8_t packet_out[CCM_HEADER_LENGTH + CCM_MAX_LENGTH + CCM_MIC_LENGTH];
+static uint8_t scratch[CCM_SCRATCH_LENGTH];
+
+static void (*onCCMDoneCB)(uint8_t* encrypted, uint8_t length);
+
+void CCM_AAR_IRQHandler(void)
+{
+    TRACE_EVENT(TRACE_CCM_IRQ, 0, 0);
+
+    if (NRF_CCM->EVENTS_ERROR)
+    {
+        NRF_CCM->EVENTS_ERROR = 0;
+
+        // Key stream was not ready in time, start over
+        NRF_CCM->TASKS_KSGEN = 1;
+    }
+
+    if (NRF_CCM->EVENTS_ENDCRYPT)
+    {
+        NRF_CCM->EVENTS_ENDCRYPT = 0;
+        NRF_CCM->EVENTS_ENDKSGEN = 0;
+        NRF_CCM->ENABLE = CCM_ENABLE_ENABLE_Disabled << CCM_ENABLE_ENABLE_Pos;
+        ENERGY_STOP(ENERGY_CCM);
+
+        // The AES core is free again for an ECB job CCM pushed out
+        aes_resume();
+
+        // Clear the callback first, it may start the next encryption
+        void (*cb)(uint8_t* encrypted, uint8_t length) = onCCMDoneCB;
+        onCCMDoneCB = NULL;
+        cb(&packet_out[CCM_HEADER_LENGTH], packet_out[1]);
+    }
+}
+
+void ccm_init(void)
+{
+    NVIC_DisableIRQ(CCM_AAR_IRQn);
+
+    NRF_CCM->INTENSET = CCM_INTENSET_ENDCRYPT_Msk | CCM_INTENSET_ERROR_Msk;
+
+    NVIC_ClearPendingIRQ(CCM_AAR_IRQn);
+    NVIC_EnableIRQ(CCM_AAR_IRQn);
+    NVIC_SetPriority(CCM_AAR_IRQn, 0);
+}
+
+bool ccm_encrypt(uint8_t key[16], uint32_t counter, uint8_t iv[8], uint8_t* data, uint8_t length, void (*cb)(uint8_t* encrypted, uint8_t length))
+{
+    if (onCCMDoneCB != NULL || length > CCM_MAX_LENGTH)
+    {
+        return false;
+    }
+
+    onCCMDoneCB = cb;
+
+    memcpy(cnf.key, key, 16);
+    memset(cnf.counter, 0, sizeof(cnf.counter));
+    cnf.counter[0] = (counter & 0xFF);
+    cnf.counter[1] = ((counter >> 8) & 0xFF);
+    cnf.counter[2] = ((counter >> 16) & 0xFF);
+    cnf.counter[3] = ((counter >> 24) & 0xFF);
+    cnf.direction = 0;
+    memcpy(cnf.iv, iv, 8);
+
+    // Header byte is authenticated as well, we keep it zero
+    packet_in[0] = 0;
+    packet_in[1] = length;
+    packet_in[2] = 0;
+    memcpy(&packet_in[CCM_HEADER_LENGTH], data, length);
+
+    NRF_CCM->ENABLE = CCM_ENABLE_ENABLE_Enabled << CCM_ENABLE_ENABLE_Pos;
+    NRF_CCM->MODE = CCM_MODE_MODE_Encryption << CCM_MODE_MODE_Pos;
+    NRF_CCM->CNFPTR = (uint32_t) &cnf;
+    NRF_CCM->INPTR = (uint32_t) packet_in;
+    NRF_CCM->OUTPTR = (uint32_t) packet_out;
+    NRF_CCM->SCRATCHPTR = (uint32_t) scratch;
+    NRF_CCM->SHORTS = CCM_SHORTS_ENDKSGEN_CRYPT_Msk;
+
+    NRF_CCM->EVENTS_ENDKSGEN = 0;
+    NRF_CCM->EVENTS_ENDCRYPT = 0;
+    NRF_CCM->EVENTS_ERROR = 0;
+    NRF_CCM->TASKS_KSGEN = 1;
+    ENERGY_START(ENERGY_CCM);
+
+    TRACE_EVENT(TRACE_CCM_START, length, counter);
+
+    return true;
+}
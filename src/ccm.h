@@ -0,0 +1,27 @@
+#ifndef DOOR_CCM_H__
+#define DOOR_CCM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CCM_MIC_LENGTH      4       // Bytes of MIC appended behind the encrypted data
+#define CCM_MAX_LENGTH      16      // Maximum length of data which can be encrypted at once
+
+void ccm_init(void);
+
+/**
+ * @brief Encrypt and authenticate data with the AES-CCM peripheral. The nonce is built by the
+ * hardware from the packet counter and the IV, the same way it is done for BLE link encryption.
+ *
+ * @param key 16 byte AES key
+ * @param counter packet counter, goes into the lower bits of the nonce
+ * @param iv 8 byte IV, goes into the upper bytes of the nonce
+ * @param data data to encrypt, at most CCM_MAX_LENGTH bytes
+ * @param length length of the data
+ * @param cb called with the encrypted data followed by the MIC (length + CCM_MIC_LENGTH bytes)
+ *
+ * @return false when an encryption is still running and nothing was started
+ */
+bool ccm_encrypt(uint8_t key[16], uint32_t counter, uint8_t iv[8], uint8_t* data, uint8_t length, void (*cb)(uint8_t* encrypted, uint8_t length));
+
+#endif
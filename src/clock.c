@@ -1,31 +1,30 @@
 #include "nrf.h"
 #include "clock.h"
 #include "timer.h"
+#include "energy.h"
+#include "trace.h"
+#include "isr_timing.h"
+#include "log.h"
 #include "compiler.h"
 
 #include <stddef.h>
 #include <stdbool.h>
 
-#ifdef LOG
-#include "rtt/SEGGER_RTT.h"
-#endif
+#define LOG_MODULE CLOCK
 
 static void (*onInitCB)();
 static void (*onHFCLKStartedCB)();
 
 static bool started = false;
 
-RAM_CODE void POWER_CLOCK_IRQHandler(void)
+RAM_CODE(POWER_CLOCK_IRQHandler) void POWER_CLOCK_IRQHandler(void)
 {
-    #ifdef LOG
-    SEGGER_RTT_printf(0, "%u> CLOCK: Interrupt\r\n", timer_get_seconds());
-    #endif
+    ISR_TIMING_ENTER(ISR_POWER_CLOCK);
+    TRACE_EVENT(TRACE_CLOCK_IRQ, 0, 0);
 
 if (NRF_CLOCK->EVENTS_CTTO)
     {
-        #ifdef LOG
-        SEGGER_RTT_printf(0, "%u> CLOCK: Syncing LFCLK against HFCLK\r\n", timer_get_seconds());
-        #endif
+        TRACE_EVENT(TRACE_CLOCK_CAL_START, 0, 0);
 
         NRF_CLOCK->EVENTS_CTTO = 0;
 
@@ -47,18 +46,14 @@ if (NRF_CLOCK->EVENTS_CTTO)
         NRF_CLOCK->TASKS_CTSTART = 1;
         NRF_CLOCK->EVENTS_DONE = 0;  
 
-        #ifdef LOG
-        SEGGER_RTT_printf(0, "%u> CLOCK: Done syncing LFCLK\r\n", timer_get_seconds());
-        #endif       
+        TRACE_EVENT(TRACE_CLOCK_CAL_DONE, 0, 0);
     }
 
     if (NRF_CLOCK->EVENTS_LFCLKSTARTED) 
     {
         NRF_CLOCK->EVENTS_LFCLKSTARTED = 0;
 
-        #ifdef LOG
-        SEGGER_RTT_printf(0, "%u> CLOCK: LFCLK started\r\n", timer_get_seconds());
-        #endif
+        TRACE_EVENT(TRACE_CLOCK_LF_STARTED, 0, 0);
 
         started = true;
         if (onInitCB != NULL)
@@ -72,9 +67,7 @@ if (NRF_CLOCK->EVENTS_CTTO)
     {
         NRF_CLOCK->EVENTS_HFCLKSTARTED = 0;
 
-        #ifdef LOG
-        SEGGER_RTT_printf(0, "%u> CLOCK: HFCLK started up\r\n", timer_get_seconds());
-        #endif
+        TRACE_EVENT(TRACE_CLOCK_HF_STARTED, 0, 0);
 
         if (onHFCLKStartedCB != NULL)
         {
@@ -82,6 +75,8 @@ if (NRF_CLOCK->EVENTS_CTTO)
             onHFCLKStartedCB = NULL;
         }
     }
+
+    ISR_TIMING_EXIT(ISR_POWER_CLOCK);
 }
 
 void clock_init(void (*cb)()) 
@@ -100,9 +95,7 @@ void clock_init(void (*cb)())
     NRF_CLOCK->EVENTS_LFCLKSTARTED = 0;
     NRF_CLOCK->TASKS_LFCLKSTART = 1;
 
-    #ifdef LOG
-    SEGGER_RTT_printf(0, "%u> CLOCK: Trying to start LFCLK with xtal\r\n", timer_get_seconds());
-    #endif
+    LOG_INFO("CLOCK: Trying to start LFCLK with xtal");
 
     // Check if LFCLK started
     for(uint32_t i = 0; i < 5000; i++)
@@ -118,24 +111,22 @@ void clock_init(void (*cb)())
     NRF_CLOCK->CTIV = 32;               // Every 8 seconds
     NRF_CLOCK->TASKS_LFCLKSTART = 1;
 
-    #ifdef LOG
-    SEGGER_RTT_printf(0, "%u> CLOCK: Trying to start LFCLK with RC\r\n", timer_get_seconds());
-    #endif
+    LOG_INFO("CLOCK: Trying to start LFCLK with RC");
 }
 
-RAM_CODE void clock_start_hf(void (*cb)())
+RAM_CODE(clock_start_hf) void clock_start_hf(void (*cb)())
 {
     onHFCLKStartedCB = cb;
     NRF_CLOCK->TASKS_HFCLKSTART = 1;
+    ENERGY_START(ENERGY_HFXO);
 }
 
-RAM_CODE void clock_stop_hf(void (*cb)())
+RAM_CODE(clock_stop_hf) void clock_stop_hf(void (*cb)())
 {
     NRF_CLOCK->TASKS_HFCLKSTOP = 1;
+    ENERGY_STOP(ENERGY_HFXO);
  
-    #ifdef LOG
-    SEGGER_RTT_printf(0, "%u> CLOCK: HFCLK stopped\r\n", timer_get_seconds());
-    #endif
+    TRACE_EVENT(TRACE_CLOCK_HF_STOPPED, 0, 0);
  
     if (cb != NULL) 
     {
@@ -1,10 +1,20 @@
 #ifndef DOOR_COMPILER_H_
 #define DOOR_COMPILER_H_
 
-#ifdef LOG
-#define RAM_CODE
+#define RAM_CODE_ATTRIBUTE __attribute__((used, long_call, section(".data")))
+
+/*
+ * RAM_CODE(function) marks a function which runs on every advertising event. Where it ends up
+ * depends on CODE_PLACEMENT: MANUAL puts all of them in RAM, FLASH none and PROFILE the ones
+ * code_placement.cmake found cheaper in RAM. With LOG everything stays in flash.
+ */
+#if defined(LOG) || defined(CODE_PLACEMENT_FLASH)
+#define RAM_CODE(function)
+#elif defined(CODE_PLACEMENT_PROFILE)
+#include "code_placement.h"
+#define RAM_CODE(function) CODE_PLACE_##function
 #else
-#define RAM_CODE __attribute__((used, long_call, section(".data")))
+#define RAM_CODE(function) RAM_CODE_ATTRIBUTE
 #endif
 
-#endif
\ No newline at end of file
+#endif
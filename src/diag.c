@@ -0,0 +1,53 @@
+#include "diag.h"
+#include "ble.h"
+#include "battery.h"
+#include "idle.h"
+#include "ble_callback_chain.h"
+#include "compiler.h"
+
+#include <string.h>
+
+/*
+ * The diagnostics frame is sent in the clear, so it only carries health data which says
+ * nothing about where the tag was. Receivers tell it apart from the payload by its length.
+ */
+
+#define FLAGS_LENGTH    3       // Flags AD structure in front of the manufacturer data
+
+RAM_CODE(diag_build) void diag_build(uint8_t* pdu, const uint8_t* adv_pdu)
+{
+    // PDU header, BD addr and the flags AD structure stay the same
+    memcpy(pdu, adv_pdu, 3 + M_BD_ADDR_SIZE + FLAGS_LENGTH);
+
+    uint8_t* data = &pdu[3 + M_BD_ADDR_SIZE + FLAGS_LENGTH];
+    data[0] = 3 + DIAG_LENGTH;
+    data[1] = 0xFF;
+    data[2] = 0x59;
+    data[3] = 0x00;
+
+    uint16_t mv = battery_mv();
+    uint32_t spurious = idle_stats()->wakes[IDLE_WAKE_SPURIOUS];
+    if (spurious > 0xFFFF)
+    {
+        spurious = 0xFFFF;
+    }
+
+    // The first advert always went out before a diagnostics frame, only a very slow boot saturates
+    uint32_t first_advert = ble_callback_chain_first_advert();
+    if (first_advert > 0xFFFF)
+    {
+        first_advert = 0xFFFF;
+    }
+
+    data[4] = DIAG_VERSION;
+    data[5] = battery_low() ? DIAG_FLAG_LOW_BATTERY : 0;
+    data[6] = ((mv >> 8) & 0xFF);
+    data[7] = (mv & 0xFF);
+    data[8] = battery_level();
+    data[9] = ((spurious >> 8) & 0xFF);
+    data[10] = (spurious & 0xFF);
+    data[11] = ((first_advert >> 8) & 0xFF);
+    data[12] = (first_advert & 0xFF);
+
+    pdu[1] = M_BD_ADDR_SIZE + FLAGS_LENGTH + 4 + DIAG_LENGTH;
+}
@@ -0,0 +1,17 @@
+#ifndef DOOR_DIAG_H__
+#define DOOR_DIAG_H__
+
+#include <stdint.h>
+
+#define DIAG_INTERVAL   60      // Every n-th advert carries the diagnostics frame instead of the payload
+#define DIAG_VERSION    0xD0
+#define DIAG_LENGTH     9       // Version, flags, 2 bytes VDD, battery level, 2 bytes spurious wakes and 2 bytes first advert
+
+#define DIAG_FLAG_LOW_BATTERY   0x01
+
+/**
+ * @brief Build the diagnostics PDU, address and flags are taken over from the advertising PDU
+ */
+void diag_build(uint8_t* pdu, const uint8_t* adv_pdu);
+
+#endif
@@ -0,0 +1,160 @@
+#include "drbg.h"
+#include "aes.h"
+#include "timer.h"
+#include "trace.h"
+#include "compiler.h"
+
+#include <string.h>
+
+#define LOG_MODULE RNG
+
+/*
+ * CTR_DRBG (NIST SP 800-90A) with AES-128 and without derivation function. Every block
+ * cipher call goes through the ECB job queue, each finished job queues the next one.
+ */
+
+static uint8_t key[16];
+static uint8_t v[16];
+static uint32_t reseed_counter = DRBG_RESEED_INTERVAL;    // Unseeded until the first reseed
+
+static uint8_t provided[DRBG_SEED_LENGTH];                // Data mixed into the state by the running update
+static uint8_t temp[DRBG_SEED_LENGTH];
+static uint8_t step;                                      // Block cipher calls done in the current request
+static uint8_t output_blocks;                             // Output blocks of the current request, 0 for a pure update
+static bool busy = false;
+
+static void (*onBlockCB)(uint8_t block[16]);
+static void (*onDoneCB)();
+
+static void drbg_on_encrypted(uint8_t encrypted[16]);
+
+static bool drbg_next(void)
+{
+    // V = V + 1, only kept when the job could be queued
+    uint8_t next[16];
+    memcpy(next, v, 16);
+    for (int8_t i = 15; i >= 0; i--)
+    {
+        if (++next[i] != 0)
+        {
+            break;
+        }
+    }
+
+    if (!aes_encrypt(key, NULL, next, drbg_on_encrypted))
+    {
+        return false;
+    }
+
+    memcpy(v, next, 16);
+    return true;
+}
+
+static void drbg_on_encrypted(uint8_t encrypted[16])
+{
+    if (step < output_blocks)
+    {
+        onBlockCB(encrypted);
+    }
+    else
+    {
+        memcpy(&temp[(step - output_blocks) * 16], encrypted, 16);
+    }
+
+    step++;
+
+    if (step < output_blocks + 2)
+    {
+        // A slot just got free in the ECB queue, so this never fails
+        drbg_next();
+        return;
+    }
+
+    // Update: (key, v) = temp XOR provided data
+    for (uint8_t i = 0; i < 16; i++)
+    {
+        key[i] = temp[i] ^ provided[i];
+        v[i] = temp[16 + i] ^ provided[16 + i];
+    }
+
+    busy = false;
+
+    if (onDoneCB != NULL)
+    {
+        onDoneCB();
+    }
+}
+
+static bool drbg_start(uint8_t blocks)
+{
+    if (busy)
+    {
+        return false;
+    }
+
+    busy = true;
+    step = 0;
+    output_blocks = blocks;
+
+    if (!drbg_next())
+    {
+        busy = false;
+        return false;
+    }
+
+    return true;
+}
+
+bool drbg_reseed(uint8_t seed[DRBG_SEED_LENGTH], void (*cb)())
+{
+    if (busy)
+    {
+        return false;
+    }
+
+    memcpy(provided, seed, DRBG_SEED_LENGTH);
+    onBlockCB = NULL;
+    onDoneCB = cb;
+
+    if (!drbg_start(0))
+    {
+        return false;
+    }
+
+    reseed_counter = 0;
+
+    TRACE_EVENT(TRACE_DRBG_RESEED, 0, 0);
+
+    return true;
+}
+
+bool drbg_generate(void (*block_cb)(uint8_t block[16]), void (*done_cb)())
+{
+    if (busy || drbg_needs_reseed())
+    {
+        return false;
+    }
+
+    // Output is followed by an update without additional input
+    memset(provided, 0, DRBG_SEED_LENGTH);
+    onBlockCB = block_cb;
+    onDoneCB = done_cb;
+
+    if (!drbg_start(DRBG_BLOCKS_PER_REQUEST))
+    {
+        return false;
+    }
+
+    reseed_counter++;
+    return true;
+}
+
+bool drbg_needs_reseed(void)
+{
+    return reseed_counter >= DRBG_RESEED_INTERVAL;
+}
+
+bool drbg_busy(void)
+{
+    return busy;
+}
@@ -0,0 +1,36 @@
+#ifndef DOOR_DRBG_H__
+#define DOOR_DRBG_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DRBG_SEED_LENGTH        32      // Seed length of CTR_DRBG with AES-128 and no derivation function
+#define DRBG_BLOCKS_PER_REQUEST 2       // Output blocks per generate request
+#define DRBG_RESEED_INTERVAL    4096    // Generate requests before fresh entropy is needed
+
+/**
+ * @brief (Re)seed the DRBG with full entropy from the hardware RNG. The first call instantiates it.
+ * 
+ * @param seed DRBG_SEED_LENGTH bytes of entropy
+ * @param cb called once the new state is in place
+ * @return false when the DRBG is busy or the ECB queue is full, nothing was started
+ */
+bool drbg_reseed(uint8_t seed[DRBG_SEED_LENGTH], void (*cb)());
+
+/**
+ * @brief Generate DRBG_BLOCKS_PER_REQUEST blocks of random data. Runs on the ECB in the background.
+ * 
+ * @param block_cb called for every generated 16 byte block
+ * @param done_cb called after the state was updated and the next request can be started
+ * @return false when the DRBG is busy, needs a reseed or the ECB queue is full
+ */
+bool drbg_generate(void (*block_cb)(uint8_t block[16]), void (*done_cb)());
+
+/**
+ * @brief Check if the DRBG has to be reseeded before it can generate again
+ */
+bool drbg_needs_reseed(void);
+
+bool drbg_busy(void);
+
+#endif
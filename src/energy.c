@@ -0,0 +1,155 @@
+#include "nrf.h"
+#include "hal.h"
+#include "energy.h"
+#include "timer.h"
+#include "log.h"
+#include "compiler.h"
+
+#include <stdbool.h>
+
+#define LOG_MODULE POWER
+
+#ifdef ENERGY
+
+/*
+ * On-time of every consumer is measured with RTC0 running straight from LFCLK (30.5us per
+ * tick) and booked as charge with the typical current from the datasheet. This is an
+ * estimate, but it is good enough to compare where the charge goes and how a change in the
+ * advertising path shifts it. RTC0 wraps every 512 seconds, no consumer is on that long.
+ */
+
+#define ENERGY_TICKS_PER_SECOND     32768UL
+#define RTC_TICKS_PER_SECOND        8UL         // RTC1, see timer.c
+
+typedef struct {
+    int8_t dbm;
+    uint16_t current_ua;
+} tx_current_def;
+
+#if defined(HAL_NRF51)
+// nRF51822 product specification, DC/DC off
+static const tx_current_def tx_currents[] = {
+    { 4, 16000 }, { 0, 10500 }, { -4, 8800 }, { -8, 8000 }, { -12, 7500 }, { -16, 7000 }, { -20, 6500 }, { -30, 6000 },
+};
+
+static const uint16_t currents_ua[ENERGY_COUNT] = {
+    10500,                          // Radio, replaced by the TX power entry
+    470,                            // HFXO
+    670,                            // RNG
+    2100,                           // ECB
+    2100,                           // CCM
+    4100,                           // CPU running from flash at 16 MHz
+    4000,                           // NVMC write or erase
+    500,                            // Constant latency on top of low power, rough estimate
+};
+#else
+// nRF52832 product specification, DC/DC on. +8 dBm is from the nRF52833 one
+static const tx_current_def tx_currents[] = {
+    { 8, 14200 }, { 4, 7500 }, { 0, 5300 }, { -4, 4200 }, { -8, 3800 }, { -12, 3500 }, { -16, 3300 }, { -20, 3200 }, { -40, 2700 },
+};
+
+static const uint16_t currents_ua[ENERGY_COUNT] = {
+    5300,                           // Radio, replaced by the TX power entry
+    250,                            // HFXO
+    500,                            // RNG
+    2100,                           // ECB
+    2100,                           // CCM
+    3700,                           // CPU running from flash at 64 MHz
+    2500,                           // NVMC write or erase
+    500,                            // Constant latency on top of low power, rough estimate
+};
+#endif
+
+static uint64_t charge[ENERGY_COUNT];           // uA times RTC0 ticks
+static uint32_t started[ENERGY_COUNT];          // RTC0 counter when the consumer was switched on
+static uint8_t running = 0;                     // Bit per consumer
+static uint16_t tx_current_ua;
+static uint32_t init_ticks;                     // RTC1 ticks at energy_init
+
+static uint16_t energy_tx_current(int8_t dbm)
+{
+    // Highest listed power which is not above the requested one
+    for (uint8_t i = 0; i < sizeof(tx_currents) / sizeof(tx_currents[0]); i++)
+    {
+        if (tx_currents[i].dbm <= dbm)
+        {
+            return tx_currents[i].current_ua;
+        }
+    }
+
+    return tx_currents[(sizeof(tx_currents) / sizeof(tx_currents[0])) - 1].current_ua;
+}
+
+void energy_init(void)
+{
+    NRF_RTC0->PRESCALER = 0;
+    NRF_RTC0->TASKS_START = 1;
+
+    init_ticks = timer_get_ticks();
+    tx_current_ua = currents_ua[ENERGY_RADIO];
+}
+
+RAM_CODE(energy_start) void energy_start(energy_consumer consumer)
+{
+    // Flash steps book from the idle loop, everything else from interrupts
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (!(running & (1 << consumer)))
+    {
+        running |= (1 << consumer);
+        started[consumer] = NRF_RTC0->COUNTER;
+    }
+
+    __set_PRIMASK(primask);
+}
+
+RAM_CODE(energy_stop) void energy_stop(energy_consumer consumer)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (running & (1 << consumer))
+    {
+        running &= ~(1 << consumer);
+
+        // 24 bit counter
+        uint32_t ticks = (NRF_RTC0->COUNTER - started[consumer]) & 0xFFFFFF;
+        uint16_t current = (consumer == ENERGY_RADIO) ? tx_current_ua : currents_ua[consumer];
+        charge[consumer] += (uint64_t) ticks * current;
+    }
+
+    __set_PRIMASK(primask);
+}
+
+void energy_add_charge(energy_consumer consumer, uint32_t nc)
+{
+    // 1 nC is 1 uA for 1 ms
+    charge[consumer] += ((uint64_t) nc * ENERGY_TICKS_PER_SECOND) / 1000;
+}
+
+void energy_set_tx_power(int8_t dbm)
+{
+    tx_current_ua = energy_tx_current(dbm);
+}
+
+uint32_t energy_average_ua(energy_consumer consumer)
+{
+    uint64_t elapsed = (uint64_t) (timer_get_ticks() - init_ticks) * (ENERGY_TICKS_PER_SECOND / RTC_TICKS_PER_SECOND);
+    if (elapsed == 0)
+    {
+        return 0;
+    }
+
+    return (uint32_t) (charge[consumer] / elapsed);
+}
+
+void energy_report(void)
+{
+    LOG_INFO("ENERGY: uAh per hour RADIO %u, HFXO %u, RNG %u, ECB %u, CCM %u, CPU %u, NVMC %u, POWER %u",
+        energy_average_ua(ENERGY_RADIO), energy_average_ua(ENERGY_HFXO), energy_average_ua(ENERGY_RNG), energy_average_ua(ENERGY_ECB),
+        energy_average_ua(ENERGY_CCM), energy_average_ua(ENERGY_CPU), energy_average_ua(ENERGY_NVMC),
+        energy_average_ua(ENERGY_POWER));
+}
+
+#endif
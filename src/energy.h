@@ -0,0 +1,69 @@
+#ifndef DOOR_ENERGY_H__
+#define DOOR_ENERGY_H__
+
+#include <stdint.h>
+
+typedef enum {
+    ENERGY_RADIO = 0,               // Radio ramp up and TX at the configured power
+    ENERGY_HFXO,
+    ENERGY_RNG,
+    ENERGY_ECB,
+    ENERGY_CCM,
+    ENERGY_CPU,                     // Core awake
+    ENERGY_NVMC,                    // Flash writes and erases
+    ENERGY_POWER,                   // Constant latency and DC/DC start up, see pwr_mgmt.c
+    ENERGY_COUNT
+} energy_consumer;
+
+/**
+ * @brief Start RTC0 as time base for the ledger, LFCLK has to be running
+ */
+void energy_init(void);
+
+/**
+ * @brief Mark a consumer as switched on, does nothing if it already is
+ */
+void energy_start(energy_consumer consumer);
+
+/**
+ * @brief Mark a consumer as switched off and book its charge, does nothing if it is not on
+ */
+void energy_stop(energy_consumer consumer);
+
+/**
+ * @brief Book a fixed charge in nC on a consumer, for costs which do not scale with on-time
+ */
+void energy_add_charge(energy_consumer consumer, uint32_t nc);
+
+/**
+ * @brief Tell the ledger which TX power the radio uses from now on
+ */
+void energy_set_tx_power(int8_t dbm);
+
+/**
+ * @brief Estimated average current of a consumer since energy_init() in uA, which is the same as uAh per hour
+ */
+uint32_t energy_average_ua(energy_consumer consumer);
+
+/**
+ * @brief Print the estimate of every consumer over RTT, does nothing below LOG_LEVEL_INFO for POWER
+ */
+void energy_report(void);
+
+/*
+ * The ledger is only built with -DENERGY=ON, shipped tags do not pay for the bookkeeping.
+ * The drivers book through these macros, which compile to nothing otherwise.
+ */
+#ifdef ENERGY
+#define ENERGY_START(consumer)              energy_start(consumer)
+#define ENERGY_STOP(consumer)               energy_stop(consumer)
+#define ENERGY_ADD_CHARGE(consumer, nc)     energy_add_charge((consumer), (nc))
+#define ENERGY_SET_TX_POWER(dbm)            energy_set_tx_power(dbm)
+#else
+#define ENERGY_START(consumer)
+#define ENERGY_STOP(consumer)
+#define ENERGY_ADD_CHARGE(consumer, nc)
+#define ENERGY_SET_TX_POWER(dbm)
+#endif
+
+#endif
@@ -0,0 +1,57 @@
+#include "epoch.h"
+#include "timer.h"
+#include "kv.h"
+#include "trace.h"
+#include "log.h"
+#include "compiler.h"
+
+#define LOG_MODULE EPOCH
+
+/*
+ * The checkpoint in the key/value store is not the time we were at but the time we are allowed
+ * to reach: every checkpoint reserves EPOCH_LEASE seconds ahead. After a reset the time resumes
+ * at the reserved value, which is past everything sent before, no matter when the reset hit.
+ * Payloads are encrypted a batch ahead, so the batch has to cover far less than half a lease.
+ */
+
+static uint32_t base = 0;                   // Epoch time at boot
+static uint32_t reserved = 0;               // Epoch time covered by the last checkpoint
+
+static void epoch_reserve(uint32_t now)
+{
+    reserved = now + EPOCH_LEASE;
+    kv_set(KV_KEY_LAST_TIME, &reserved, sizeof(reserved));
+}
+
+void epoch_init(void)
+{
+    if (!kv_get(KV_KEY_LAST_TIME, &base, sizeof(base)))
+    {
+        base = 0;
+    }
+
+    // Goes to flash after the first advert at the latest. A reset before that repeats at most that first second, which
+    // the reboot counter did not move on for either, so the server just sees it as already known
+    epoch_reserve(epoch_get());
+    kv_flush();
+
+    LOG_INFO("EPOCH: Resumed at %u, reserved up to %u", base, reserved);
+}
+
+RAM_CODE(epoch_get) uint32_t epoch_get(void)
+{
+    return base + timer_get_seconds();
+}
+
+void epoch_checkpoint(void)
+{
+    uint32_t now = epoch_get();
+    if (now + (EPOCH_LEASE / 2) < reserved)
+    {
+        return;
+    }
+
+    epoch_reserve(now);
+
+    TRACE_EVENT(TRACE_EPOCH_CHECKPOINT, reserved, 0);
+}
@@ -0,0 +1,23 @@
+#ifndef DOOR_EPOCH_H__
+#define DOOR_EPOCH_H__
+
+#include <stdint.h>
+
+#define EPOCH_LEASE     3600    // Seconds reserved ahead with every checkpoint
+
+/**
+ * @brief Resume from the last checkpoint and reserve the first lease. The checkpoint goes to flash after the first advert at the latest.
+ */
+void epoch_init(void);
+
+/**
+ * @brief Seconds which keep increasing across reboots, used for the payload timestamps
+ */
+uint32_t epoch_get(void);
+
+/**
+ * @brief Stage a new checkpoint once half of the current lease is used up. Goes to flash with the next kv_flush().
+ */
+void epoch_checkpoint(void);
+
+#endif
@@ -0,0 +1,217 @@
+#include "nrf.h"
+#include "hal.h"
+#include "flash.h"
+#include "timer.h"
+#include "energy.h"
+#include "pwr_mgmt.h"
+#include "trace.h"
+#include "compiler.h"
+
+#include <stddef.h>
+
+#define LOG_MODULE FLASH
+
+/*
+ * The NVMC has no interrupt and the CPU stalls while flash is written, so operations are queued
+ * and worked off in small steps whenever the scheduler knows the radio is idle. Each step is
+ * charged against the window budget with its worst case duration from the datasheet.
+ */
+
+#define WRITE_TIME_US           50      // tWRITE is 41us on nRF51 and nRF52
+
+#if defined(NVMC_ERASEPAGEPARTIALCFG_DURATION_Msk)
+#define ERASE_SLICE_MS          10      // Duration of one partial erase
+#define ERASE_SLICES            9       // Partial erases have to add up to tERASEPAGE (85ms)
+#define ERASE_STEP_US           (ERASE_SLICE_MS * 1000)
+#else
+#define ERASE_SLICES            1       // No partial erase, the page goes in one step
+#define ERASE_STEP_US           22500   // tERASEPAGE on nRF51
+#endif
+
+typedef enum {
+    FLASH_OP_WRITE = 0,
+    FLASH_OP_ERASE
+} flash_op_type;
+
+typedef struct {
+    flash_op_type type;
+    volatile uint32_t* address;
+    const uint32_t* data;
+    uint16_t steps;                     // Words to write or erase slices to run
+    uint16_t done;
+    uint32_t queued;                    // RTC ticks when the op was queued
+    void (*cb)(void);
+} flash_op;
+
+static flash_op ops[FLASH_QUEUE_SIZE];
+static uint8_t ops_head = 0;
+static uint8_t ops_count = 0;
+static flash_stats_def stats;
+
+static void flash_wait_ready(void)
+{
+    while (NRF_NVMC->READY == NVMC_READY_READY_Busy);
+}
+
+static void flash_step(flash_op* op)
+{
+    ENERGY_START(ENERGY_NVMC);
+
+    if (op->type == FLASH_OP_WRITE)
+    {
+        NRF_NVMC->CONFIG = NVMC_CONFIG_WEN_Wen << NVMC_CONFIG_WEN_Pos;
+        flash_wait_ready();
+
+        op->address[op->done] = op->data[op->done];
+        flash_wait_ready();
+    }
+    else
+    {
+        NRF_NVMC->CONFIG = NVMC_CONFIG_WEN_Een << NVMC_CONFIG_WEN_Pos;
+        flash_wait_ready();
+
+        #if defined(NVMC_ERASEPAGEPARTIALCFG_DURATION_Msk)
+        NRF_NVMC->ERASEPAGEPARTIALCFG = ERASE_SLICE_MS;
+        NRF_NVMC->ERASEPAGEPARTIAL = (uint32_t) op->address;
+        #else
+        NRF_NVMC->ERASEPAGE = (uint32_t) op->address;
+        #endif
+        flash_wait_ready();
+    }
+
+    NRF_NVMC->CONFIG = NVMC_CONFIG_WEN_Ren << NVMC_CONFIG_WEN_Pos;
+    flash_wait_ready();
+
+    ENERGY_STOP(ENERGY_NVMC);
+    op->done++;
+}
+
+static bool flash_queue(flash_op_type type, volatile uint32_t* address, const uint32_t* data, uint16_t steps, void (*cb)(void))
+{
+    if (ops_count == FLASH_QUEUE_SIZE)
+    {
+        TRACE_EVENT(TRACE_FLASH_FULL, 0, 0);
+
+        return false;
+    }
+
+    flash_op* op = &ops[(ops_head + ops_count) % FLASH_QUEUE_SIZE];
+    op->type = type;
+    op->address = address;
+    op->data = data;
+    op->steps = steps;
+    op->done = 0;
+    op->queued = timer_get_ticks();
+    op->cb = cb;
+    ops_count++;
+
+    return true;
+}
+
+void flash_init(void)
+{
+    hal_flash_cache_enable();
+
+    ops_head = 0;
+    ops_count = 0;
+}
+
+bool flash_write(volatile uint32_t* address, const uint32_t* data, uint16_t words, void (*cb)(void))
+{
+    return flash_queue(FLASH_OP_WRITE, address, data, words, cb);
+}
+
+bool flash_erase(volatile uint32_t* page, void (*cb)(void))
+{
+    return flash_queue(FLASH_OP_ERASE, page, NULL, ERASE_SLICES, cb);
+}
+
+uint8_t flash_queue_free(void)
+{
+    return FLASH_QUEUE_SIZE - ops_count;
+}
+
+bool flash_busy(void)
+{
+    return ops_count > 0;
+}
+
+static void flash_finish_head(void)
+{
+    flash_op* op = &ops[ops_head];
+    void (*cb)(void) = op->cb;
+
+    uint32_t latency = timer_get_ticks() - op->queued;
+    stats.ops++;
+    stats.latency_total += latency;
+    if (latency > stats.latency_max)
+    {
+        stats.latency_max = latency;
+    }
+
+    TRACE_EVENT(TRACE_FLASH_DONE, op->type, latency);
+
+    ops_head = (ops_head + 1) % FLASH_QUEUE_SIZE;
+    ops_count--;
+
+    // Callback may queue the next op right away. It runs from the idle loop and updates state
+    // interrupts use as well, so they have to wait until it is done.
+    if (cb != NULL)
+    {
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        cb();
+        __set_PRIMASK(primask);
+    }
+}
+
+static void flash_work(uint32_t budget)
+{
+    uint32_t spent = 0;
+
+    power_phase_start(POWER_PHASE_FLASH);
+
+    while (ops_count > 0)
+    {
+        flash_op* op = &ops[ops_head];
+        uint32_t cost = (op->type == FLASH_OP_WRITE) ? WRITE_TIME_US : ERASE_STEP_US;
+
+        // Always do at least one step, an erase can be bigger than the whole budget
+        if (spent > 0 && spent + cost > budget)
+        {
+            stats.deferred++;
+            break;
+        }
+
+        flash_step(op);
+        spent += cost;
+
+        if (op->done == op->steps)
+        {
+            flash_finish_head();
+        }
+    }
+
+    power_phase_stop(POWER_PHASE_FLASH);
+}
+
+void flash_run(void)
+{
+    if (ops_count == 0)
+    {
+        return;
+    }
+
+    stats.windows++;
+    flash_work(FLASH_WINDOW_BUDGET_US);
+}
+
+void flash_drain(void)
+{
+    flash_work(0xFFFFFFFF);
+}
+
+const flash_stats_def* flash_stats(void)
+{
+    return &stats;
+}
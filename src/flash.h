@@ -0,0 +1,58 @@
+#ifndef DOOR_FLASH_H__
+#define DOOR_FLASH_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define FLASH_QUEUE_SIZE        8       // Number of operations which can wait at the same time
+#define FLASH_WINDOW_BUDGET_US  25000   // Flash time spent in one radio free window
+
+typedef struct {
+    uint32_t ops;                       // Finished operations
+    uint32_t windows;                   // Windows which had work to do
+    uint32_t deferred;                  // Windows which ran out of budget with work left
+    uint32_t latency_max;               // RTC ticks from queueing to finishing, worst case
+    uint32_t latency_total;             // RTC ticks from queueing to finishing, sum over all ops
+} flash_stats_def;
+
+void flash_init(void);
+
+/**
+ * @brief Queue a write of words to flash. data has to stay untouched until cb was called.
+ *
+ * @return false when the queue is full and nothing was queued
+ */
+bool flash_write(volatile uint32_t* address, const uint32_t* data, uint16_t words, void (*cb)(void));
+
+/**
+ * @brief Queue an erase of the page starting at address. Uses partial erase where the chip has it,
+ * so one window never blocks for a whole page erase.
+ *
+ * @return false when the queue is full and nothing was queued
+ */
+bool flash_erase(volatile uint32_t* page, void (*cb)(void));
+
+/**
+ * @brief Number of operations which can still be queued
+ */
+uint8_t flash_queue_free(void);
+
+/**
+ * @brief Check if operations are waiting or running
+ */
+bool flash_busy(void);
+
+/**
+ * @brief Work on the queue for up to FLASH_WINDOW_BUDGET_US. Only call this when no radio event is due,
+ * and from the idle loop so interrupts can run between two steps.
+ */
+void flash_run(void);
+
+/**
+ * @brief Work on the queue until it is empty, only when no radio activity follows
+ */
+void flash_drain(void);
+
+const flash_stats_def* flash_stats(void);
+
+#endif
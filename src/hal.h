@@ -0,0 +1,171 @@
+#ifndef DOOR_HAL_H__
+#define DOOR_HAL_H__
+
+#include "nrf.h"
+
+#include <stdint.h>
+
+/*
+ * Thin layer over the parts where the nRF51 and nRF52 families differ. The family is
+ * resolved from NRF5_TARGET by CMake (HAL_NRF51 or HAL_NRF52), features only some nRF52
+ * parts have are taken from the MDK. Everything is decided at compile time and the helpers
+ * are static inline, so there is no cost over writing the registers directly.
+ *
+ * CLOCK, RTC, RNG and ECB are register compatible between the families (ECBDATAPTR points to
+ * the same 48 byte key, cleartext, ciphertext block on both), the drivers use them directly.
+ */
+
+#if defined(HAL_NRF51) == defined(HAL_NRF52)
+#error "Define either HAL_NRF51 or HAL_NRF52, CMake derives it from NRF5_TARGET"
+#endif
+
+/*
+ * Power
+ */
+
+#if defined(HAL_NRF51)
+#define HAL_DCDC_MIN_MV         2100    // DC/DC must not run below 2.1V
+#else
+#define HAL_RAM_SECTION_SIZE    0x1000  // 4KB sections, two (S0 and S1) per RAM block
+#define HAL_DCDC_MIN_MV         0       // DC/DC works over the whole supply range
+#endif
+
+/**
+ * @brief Size of the unit hal_ram_off() switches. nRF51 variants come with 4KB or 8KB blocks,
+ * switched in RAMON and RAMONB, the FICR tells which.
+ */
+static inline uint32_t hal_ram_section_size(void)
+{
+    #if defined(HAL_NRF51)
+    return NRF_FICR->SIZERAMBLOCKS;
+    #else
+    return HAL_RAM_SECTION_SIZE;
+    #endif
+}
+
+static inline uint32_t hal_ram_sections(void)
+{
+    #if defined(HAL_NRF51)
+    return NRF_FICR->NUMRAMBLOCK;
+    #else
+    return (NRF_FICR->INFO.RAM * 1024) / HAL_RAM_SECTION_SIZE;
+    #endif
+}
+
+static inline void hal_ram_off(uint32_t section)
+{
+    #if defined(HAL_NRF51)
+    // Blocks 0 and 1 are in RAMON, 2 and 3 in RAMONB. Power and retention bits are cleared together
+    volatile uint32_t* ramon = (section < 2) ? &NRF_POWER->RAMON : &NRF_POWER->RAMONB;
+    uint32_t bit = section % 2;
+    *ramon &= ~((POWER_RAMON_ONRAM0_Msk << bit) | (POWER_RAMON_OFFRAM0_Msk << bit));
+    #else
+    uint32_t bit = section % 2;
+    NRF_POWER->RAM[section / 2].POWERCLR = (POWER_RAM_POWER_S0POWER_Msk << bit) | (POWER_RAM_POWER_S0RETENTION_Msk << bit);
+    #endif
+}
+
+/**
+ * @brief Let a section lose its content in System OFF, it stays powered in System ON
+ */
+static inline void hal_ram_retention_off(uint32_t section)
+{
+    #if defined(HAL_NRF51)
+    volatile uint32_t* ramon = (section < 2) ? &NRF_POWER->RAMON : &NRF_POWER->RAMONB;
+    uint32_t bit = section % 2;
+    *ramon &= ~(POWER_RAMON_OFFRAM0_Msk << bit);
+    #else
+    uint32_t bit = section % 2;
+    NRF_POWER->RAM[section / 2].POWERCLR = (POWER_RAM_POWER_S0RETENTION_Msk << bit);
+    #endif
+}
+
+/*
+ * Flash
+ */
+
+/**
+ * @brief Turn on the NVMC instruction cache where there is one (nRF52), code which stays in
+ * flash then mostly runs from the cache instead of fetching every instruction from flash
+ */
+static inline void hal_flash_cache_enable(void)
+{
+    #if defined(NVMC_ICACHECNF_CACHEEN_Msk)
+    NRF_NVMC->ICACHECNF = NVMC_ICACHECNF_CACHEEN_Enabled << NVMC_ICACHECNF_CACHEEN_Pos;
+    #endif
+}
+
+/*
+ * Radio
+ */
+
+#if defined(RADIO_TXPOWER_TXPOWER_Pos8dBm)
+#define HAL_TX_POWER_MAX        8       // nRF52820, nRF52833 and nRF52840
+#else
+#define HAL_TX_POWER_MAX        4
+#endif
+
+#if defined(RADIO_TXPOWER_TXPOWER_Pos2dBm)
+#define HAL_TX_POWER_FINE_MIN   2       // Every dBm from here up to the maximum is a valid setting
+#elif defined(RADIO_TXPOWER_TXPOWER_Pos3dBm)
+#define HAL_TX_POWER_FINE_MIN   3
+#else
+#define HAL_TX_POWER_FINE_MIN   HAL_TX_POWER_MAX
+#endif
+
+#if defined(HAL_NRF51)
+#define HAL_TX_POWER_MIN        -30
+#else
+#define HAL_TX_POWER_MIN        -40
+#endif
+
+/**
+ * @brief Highest TX power the radio supports which is not above the requested one.
+ * TXPOWER takes the dBm value as two's complement, but only the listed steps are valid.
+ */
+static inline int8_t hal_radio_tx_power(int8_t dbm)
+{
+    if (dbm >= HAL_TX_POWER_MAX)
+    {
+        return HAL_TX_POWER_MAX;
+    }
+    if (dbm >= HAL_TX_POWER_FINE_MIN)
+    {
+        return dbm;
+    }
+    if (dbm >= 0)
+    {
+        return 0;
+    }
+    if (dbm >= -20)
+    {
+        // 4 dB steps down to -20
+        return (int8_t) -(((-dbm + 3) / 4) * 4);
+    }
+
+    return HAL_TX_POWER_MIN;
+}
+
+/**
+ * @brief Family specific radio setup, called from ble_init() after the radio was powered up
+ */
+static inline void hal_radio_init(void)
+{
+    #if defined(HAL_NRF51)
+    // Early nRF51 parts need the BLE 1Mbit trim values from FICR copied over by hand
+    if ((NRF_FICR->OVERRIDEEN & FICR_OVERRIDEEN_BLE_1MBIT_Msk) == (FICR_OVERRIDEEN_BLE_1MBIT_Override << FICR_OVERRIDEEN_BLE_1MBIT_Pos))
+    {
+        NRF_RADIO->OVERRIDE0 = NRF_FICR->BLE_1MBIT[0];
+        NRF_RADIO->OVERRIDE1 = NRF_FICR->BLE_1MBIT[1];
+        NRF_RADIO->OVERRIDE2 = NRF_FICR->BLE_1MBIT[2];
+        NRF_RADIO->OVERRIDE3 = NRF_FICR->BLE_1MBIT[3];
+        NRF_RADIO->OVERRIDE4 = NRF_FICR->BLE_1MBIT[4] | (RADIO_OVERRIDE4_ENABLE_Enabled << RADIO_OVERRIDE4_ENABLE_Pos);
+    }
+    #else
+    // Fast ramp up takes 40us instead of 140us per channel, the radio and HFXO are on that much shorter
+    NRF_RADIO->MODECNF0 = (RADIO_MODECNF0_RU_Fast << RADIO_MODECNF0_RU_Pos)
+                        | (RADIO_MODECNF0_DTX_Center << RADIO_MODECNF0_DTX_Pos);
+    #endif
+}
+
+#endif
@@ -0,0 +1,186 @@
+#include "nrf.h"
+#include "idle.h"
+#include "timer.h"
+#include "energy.h"
+#include "isr_timing.h"
+#include "log.h"
+#include "compiler.h"
+
+#include <stddef.h>
+
+#define LOG_MODULE POWER
+
+/*
+ * The CPU sleeps with interrupts masked and SEVONPEND set. A new pending interrupt still wakes
+ * the core but its handler only runs once the mask is lifted, so the pending bits tell which
+ * peripheral woke us up before anything else happened. Only ISPR[0] is read, every interrupt
+ * the firmware enables (RADIO, RTC1, POWER_CLOCK, ECB, CCM_AAR, RNG, GPIOTE, SAADC) is below 32.
+ */
+
+#if (__CORTEX_M >= 3)
+#define IDLE_CYCLE_COUNTER              // M0 (nRF51) has no DWT cycle counter
+#define IDLE_CYCLES_PER_MS      64000   // nRF52 runs the CPU at 64 MHz
+#endif
+
+static void (*jobs[IDLE_QUEUE_SIZE])(void);
+static uint8_t jobs_head = 0;
+static uint8_t jobs_count = 0;
+static idle_stats_def stats;
+
+bool idle_defer(void (*job)(void))
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (jobs_count == IDLE_QUEUE_SIZE)
+    {
+        __set_PRIMASK(primask);
+        return false;
+    }
+
+    jobs[(jobs_head + jobs_count) % IDLE_QUEUE_SIZE] = job;
+    jobs_count++;
+
+    __set_PRIMASK(primask);
+    return true;
+}
+
+static void idle_run_jobs(void)
+{
+    while (true)
+    {
+        __disable_irq();
+        if (jobs_count == 0)
+        {
+            __enable_irq();
+            return;
+        }
+
+        void (*job)(void) = jobs[jobs_head];
+        jobs_head = (jobs_head + 1) % IDLE_QUEUE_SIZE;
+        jobs_count--;
+        __enable_irq();
+
+        stats.deferred++;
+        job();
+    }
+}
+
+static idle_wake_source idle_wake_reason(uint32_t pending)
+{
+    if (pending == 0)
+    {
+        return IDLE_WAKE_SPURIOUS;
+    }
+
+    // RTC first, it starts every advertising event the others are part of
+    if (pending & (1UL << RTC1_IRQn))
+    {
+        return IDLE_WAKE_RTC;
+    }
+
+    if (pending & (1UL << RADIO_IRQn))
+    {
+        return IDLE_WAKE_RADIO;
+    }
+
+    if (pending & ((1UL << ECB_IRQn) | (1UL << CCM_AAR_IRQn)))
+    {
+        return IDLE_WAKE_ECB;
+    }
+
+    if (pending & (1UL << RNG_IRQn))
+    {
+        return IDLE_WAKE_RNG;
+    }
+
+    if (pending & (1UL << POWER_CLOCK_IRQn))
+    {
+        return IDLE_WAKE_CLOCK;
+    }
+
+    return IDLE_WAKE_OTHER;
+}
+
+#if LOG_ENABLED(LOG_MODULE, LOG_LEVEL_INFO)
+static void idle_report(void)
+{
+    LOG_INFO("IDLE: Wakes RTC %u, RADIO %u, ECB %u, RNG %u, CLOCK %u, other %u, spurious %u",
+        stats.wakes[IDLE_WAKE_RTC], stats.wakes[IDLE_WAKE_RADIO], stats.wakes[IDLE_WAKE_ECB], stats.wakes[IDLE_WAKE_RNG],
+        stats.wakes[IDLE_WAKE_CLOCK], stats.wakes[IDLE_WAKE_OTHER], stats.wakes[IDLE_WAKE_SPURIOUS]);
+    #ifdef IDLE_CYCLE_COUNTER
+    LOG_INFO("IDLE: %u deferred jobs, %u ms awake", stats.deferred, (uint32_t) (stats.awake_cycles / IDLE_CYCLES_PER_MS));
+    #else
+    LOG_INFO("IDLE: %u deferred jobs", stats.deferred);
+    #endif
+}
+#endif
+
+RAM_CODE(idle_run) void idle_run(void)
+{
+    SCB->SCR |= SCB_SCR_SEVONPEND_Msk;
+
+    #ifdef IDLE_CYCLE_COUNTER
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    #endif
+
+    uint32_t total_wakes = 0;
+    ENERGY_START(ENERGY_CPU);
+
+    while (true)
+    {
+        idle_run_jobs();
+
+        __disable_irq();
+
+        // A job queued by an interrupt since the check above would wait a whole sleep otherwise
+        if (jobs_count > 0)
+        {
+            __enable_irq();
+            continue;
+        }
+
+        #ifdef IDLE_CYCLE_COUNTER
+        stats.awake_cycles += DWT->CYCCNT;
+        #endif
+
+        ENERGY_STOP(ENERGY_CPU);
+
+        // The event register is still set from the last wake up, clear it or the sleep returns right away.
+        // Interrupts which got pending before that clear do not signal an event anymore, so check for them.
+        __SEV();
+        __WFE();
+        if (NVIC->ISPR[0] == 0)
+        {
+            __WFE();
+        }
+
+        ENERGY_START(ENERGY_CPU);
+
+        #ifdef IDLE_CYCLE_COUNTER
+        DWT->CYCCNT = 0;
+        #endif
+
+        uint32_t pending = NVIC->ISPR[0];
+        ISR_TIMING_WAKE(pending);
+        stats.wakes[idle_wake_reason(pending)]++;
+        total_wakes++;
+
+        // Handlers of the pending interrupts run right here
+        __enable_irq();
+
+        #if LOG_ENABLED(LOG_MODULE, LOG_LEVEL_INFO)
+        if (total_wakes % IDLE_REPORT_WAKES == 0)
+        {
+            idle_report();
+        }
+        #endif
+    }
+}
+
+const idle_stats_def* idle_stats(void)
+{
+    return &stats;
+}
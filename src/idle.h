@@ -0,0 +1,41 @@
+#ifndef DOOR_IDLE_H__
+#define DOOR_IDLE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define IDLE_QUEUE_SIZE     8       // Number of deferred jobs which can wait at the same time
+#define IDLE_REPORT_WAKES   256     // Wakes between two stats reports over RTT
+
+typedef enum {
+    IDLE_WAKE_RTC = 0,
+    IDLE_WAKE_RADIO,
+    IDLE_WAKE_ECB,                  // ECB and CCM
+    IDLE_WAKE_RNG,
+    IDLE_WAKE_CLOCK,
+    IDLE_WAKE_OTHER,                // Pending interrupt of another peripheral
+    IDLE_WAKE_SPURIOUS,             // Woke up without any interrupt pending
+    IDLE_WAKE_COUNT
+} idle_wake_source;
+
+typedef struct {
+    uint32_t wakes[IDLE_WAKE_COUNT];
+    uint32_t deferred;              // Deferred jobs which were run
+    uint64_t awake_cycles;          // CPU cycles between waking up and going back to sleep, 0 where the core has no cycle counter
+} idle_stats_def;
+
+/**
+ * @brief Queue a job which runs from the idle loop before the CPU sleeps again. Safe to call from interrupts.
+ *
+ * @return false when the queue is full and nothing was queued
+ */
+bool idle_defer(void (*job)(void));
+
+/**
+ * @brief Sleep until there is something to do, run deferred jobs in between. Never returns.
+ */
+void idle_run(void);
+
+const idle_stats_def* idle_stats(void);
+
+#endif
@@ -0,0 +1,108 @@
+#include "nrf.h"
+#include "isr_timing.h"
+#include "log.h"
+#include "compiler.h"
+
+#include <stdint.h>
+
+#ifdef ISR_TIMING_ENABLED
+
+static const IRQn_Type irqs[ISR_COUNT] = {
+    RADIO_IRQn,
+    RTC1_IRQn,
+    POWER_CLOCK_IRQn,
+    ECB_IRQn,
+    RNG_IRQn,
+};
+
+#if ISR_TIMING_BUCKETS != 8
+#error "isr_histogram_print() prints 8 buckets"
+#endif
+
+static const char* const names[ISR_COUNT] = {
+    "RADIO",
+    "RTC1",
+    "POWER_CLOCK",
+    "ECB",
+    "RNG",
+};
+
+static isr_timing_def timings[ISR_COUNT];
+static uint32_t wake_cycles = 0;
+static uint32_t wake_pending = 0;       // Interrupts pending at the last wake up which did not run yet
+
+void isr_timing_init(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+RAM_CODE(isr_timing_wake) void isr_timing_wake(uint32_t pending)
+{
+    wake_cycles = DWT->CYCCNT;
+    wake_pending = pending;
+}
+
+RAM_CODE(isr_histogram_add) static void isr_histogram_add(isr_histogram_def* histogram, uint32_t cycles)
+{
+    if (histogram->count == 0 || cycles < histogram->min)
+    {
+        histogram->min = cycles;
+    }
+    if (cycles > histogram->max)
+    {
+        histogram->max = cycles;
+    }
+    histogram->count++;
+
+    // Power of two buckets, the first one is ISR_TIMING_BUCKET_CYCLES wide
+    uint32_t bucket = 32 - __CLZ(cycles / ISR_TIMING_BUCKET_CYCLES);
+    if (bucket >= ISR_TIMING_BUCKETS)
+    {
+        bucket = ISR_TIMING_BUCKETS - 1;
+    }
+    histogram->buckets[bucket]++;
+}
+
+RAM_CODE(isr_timing_record) void isr_timing_record(isr_id isr, uint32_t start, uint32_t end)
+{
+    // All handlers run at priority 0 and cannot preempt each other, nothing to lock
+    isr_histogram_add(&timings[isr].duration, end - start);
+
+    uint32_t bit = 1UL << irqs[isr];
+    if (wake_pending & bit)
+    {
+        wake_pending &= ~bit;
+        isr_histogram_add(&timings[isr].latency, start - wake_cycles);
+    }
+}
+
+const isr_timing_def* isr_timing_stats(isr_id isr)
+{
+    return &timings[isr];
+}
+
+static void isr_histogram_print(const char* name, const char* kind, const isr_histogram_def* histogram)
+{
+    log_printf("ISR: %s %s %u runs, min %u max %u cycles, buckets %u %u %u %u %u %u %u %u", name, kind,
+        histogram->count, histogram->min, histogram->max,
+        histogram->buckets[0], histogram->buckets[1], histogram->buckets[2], histogram->buckets[3],
+        histogram->buckets[4], histogram->buckets[5], histogram->buckets[6], histogram->buckets[7]);
+}
+
+void isr_timing_report(void)
+{
+    for (uint8_t isr = 0; isr < ISR_COUNT; isr++)
+    {
+        // Copied with interrupts off so min, max and buckets belong together
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        isr_timing_def timing = timings[isr];
+        __set_PRIMASK(primask);
+
+        isr_histogram_print(names[isr], "duration", &timing.duration);
+        isr_histogram_print(names[isr], "latency", &timing.latency);
+    }
+}
+
+#endif
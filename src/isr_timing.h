@@ -0,0 +1,82 @@
+#ifndef DOOR_ISR_TIMING_H__
+#define DOOR_ISR_TIMING_H__
+
+#include "nrf.h"
+
+#include <stdint.h>
+
+/*
+ * Cycle counts of the interrupt handlers on the advertising path, taken with the DWT cycle
+ * counter (64 cycles per us on nRF52). ISR_TIMING_ENTER() is the first and ISR_TIMING_EXIT()
+ * the last statement of a handler, the duration is everything in between.
+ *
+ * The counter stops while the CPU sleeps, so the latency is taken from the moment the idle loop
+ * leaves WFE up to the handler entry. That covers the wake up bookkeeping and every handler
+ * served before, and is only known for interrupts which were already pending at the wake up.
+ * Interrupts raised while the CPU was awake only count for the duration.
+ *
+ * Needs -DISR_TIMING=ON and a core with DWT, on nRF51 (M0) all of this compiles to nothing.
+ */
+
+#if defined(ISR_TIMING) && (__CORTEX_M >= 3)
+#define ISR_TIMING_ENABLED
+#endif
+
+#define ISR_TIMING_BUCKETS          8       // <1us, 1-2us, 2-4us ... 32-64us, 64us and more
+#define ISR_TIMING_BUCKET_CYCLES    64      // Width of the first bucket, 1us at 64 MHz
+
+typedef enum {
+    ISR_RADIO = 0,
+    ISR_RTC1,
+    ISR_POWER_CLOCK,
+    ISR_ECB,
+    ISR_RNG,
+    ISR_COUNT
+} isr_id;
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;                   // Cycles
+    uint32_t max;
+    uint32_t buckets[ISR_TIMING_BUCKETS];
+} isr_histogram_def;
+
+typedef struct {
+    isr_histogram_def duration;
+    isr_histogram_def latency;
+} isr_timing_def;
+
+/**
+ * @brief Start the cycle counter, first thing in main so the init handlers are counted too
+ */
+void isr_timing_init(void);
+
+/**
+ * @brief Called by the idle loop right after waking up with the pending interrupts (NVIC ISPR)
+ */
+void isr_timing_wake(uint32_t pending);
+
+/**
+ * @brief Book one handler run, use ISR_TIMING_ENTER() and ISR_TIMING_EXIT() instead
+ */
+void isr_timing_record(isr_id isr, uint32_t start, uint32_t end);
+
+const isr_timing_def* isr_timing_stats(isr_id isr);
+
+/**
+ * @brief Print min, max and the histogram of every handler over RTT. Printed whatever the
+ * log levels are, ISR_TIMING is the switch. Run it from the idle loop, not from a handler.
+ */
+void isr_timing_report(void);
+
+#ifdef ISR_TIMING_ENABLED
+#define ISR_TIMING_ENTER(isr)       uint32_t isr_timing_start = DWT->CYCCNT
+#define ISR_TIMING_EXIT(isr)        isr_timing_record((isr), isr_timing_start, DWT->CYCCNT)
+#define ISR_TIMING_WAKE(pending)    isr_timing_wake(pending)
+#else
+#define ISR_TIMING_ENTER(isr)
+#define ISR_TIMING_EXIT(isr)
+#define ISR_TIMING_WAKE(pending)
+#endif
+
+#endif
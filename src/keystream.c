@@ -0,0 +1,109 @@
+#include "keystream.h"
+#include "aes.h"
+#include "kv.h"
+#include "timer.h"
+#include "trace.h"
+#include "compiler.h"
+
+#include <string.h>
+
+#define LOG_MODULE AES
+
+static keystream_def blocks[KEYSTREAM_SIZE];
+static uint8_t blocks_head = 0;
+static uint8_t blocks_ready = 0;                // Blocks which came back from the ECB
+static uint8_t blocks_pending = 0;              // Blocks handed to the ECB
+static uint32_t counter = 0;                    // Next block counter, never goes back, not even across reboots
+static uint32_t reserved = 0;                   // Counter values covered by the key/value store
+
+/*
+ * CTR without a MIC must never encrypt two messages with the same counter block. The random IV
+ * only makes that unlikely, so the counter itself carries on across reboots: like the epoch,
+ * the store holds the value the counter may reach and a reset resumes from there. The block
+ * has 24 bits of counter in the nonce the advert carries, the top byte sits in the counter
+ * block right behind it. It goes up once every 2^24 blocks (194 days at one advert per second),
+ * the receiver notices the sent counter falling back and tries the next value.
+ */
+
+static void keystream_reserve(void)
+{
+    reserved = counter + KEYSTREAM_LEASE;
+    kv_set(KV_KEY_KEYSTREAM_COUNTER, &reserved, sizeof(reserved));
+}
+
+void keystream_init(void)
+{
+    if (!kv_get(KV_KEY_KEYSTREAM_COUNTER, &counter, sizeof(counter)))
+    {
+        counter = 0;
+    }
+
+    // A reset before the lease is in flash would reuse the same counter blocks
+    keystream_reserve();
+    kv_commit();
+}
+
+void on_keystream_encrypted(uint8_t encrypted[16])
+{
+    // Jobs finish in the order they were queued
+    memcpy(blocks[(blocks_head + blocks_ready) % KEYSTREAM_SIZE].block, encrypted, 16);
+    blocks_ready++;
+    blocks_pending--;
+}
+
+void keystream_refill(uint8_t key[16], uint8_t* iv)
+{
+    uint8_t queued = 0;
+
+    // Values past the reservation could come again after a reset
+    while (blocks_ready + blocks_pending < KEYSTREAM_SIZE && counter < reserved)
+    {
+        keystream_def* keystream = &blocks[(blocks_head + blocks_ready + blocks_pending) % KEYSTREAM_SIZE];
+
+        memcpy(keystream->nonce, &iv[queued * KEYSTREAM_IV_LENGTH], KEYSTREAM_IV_LENGTH);
+        keystream->nonce[3] = ((counter >> 16) & 0xFF);
+        keystream->nonce[4] = ((counter >> 8) & 0xFF);
+        keystream->nonce[5] = (counter & 0xFF);
+
+        uint8_t counter_block[16];
+        memset(counter_block, 0, 16);
+        memcpy(counter_block, keystream->nonce, KEYSTREAM_NONCE_LENGTH);
+        counter_block[KEYSTREAM_NONCE_LENGTH] = ((counter >> 24) & 0xFF);
+
+        if (!aes_encrypt(key, NULL, counter_block, on_keystream_encrypted))
+        {
+            break;
+        }
+
+        counter++;
+        blocks_pending++;
+        queued++;
+    }
+
+    // Staged with the blocks, it goes to flash with the next kv_flush() long before the lease runs out
+    if (counter + (KEYSTREAM_LEASE / 2) >= reserved)
+    {
+        keystream_reserve();
+    }
+
+    TRACE_EVENT(TRACE_KEYSTREAM_QUEUED, queued, 0);
+}
+
+bool keystream_low(void)
+{
+    return (blocks_ready + blocks_pending) <= KEYSTREAM_WATERMARK;
+}
+
+bool keystream_take(keystream_def* keystream)
+{
+    if (blocks_ready == 0)
+    {
+        return false;
+    }
+
+    memcpy(keystream, &blocks[blocks_head], sizeof(keystream_def));
+    blocks_head = (blocks_head + 1) % KEYSTREAM_SIZE;
+    blocks_ready--;
+
+    return true;
+}
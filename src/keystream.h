@@ -0,0 +1,43 @@
+#ifndef DOOR_KEYSTREAM_H__
+#define DOOR_KEYSTREAM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define KEYSTREAM_SIZE          4       // Number of keystream blocks kept ahead
+#define KEYSTREAM_WATERMARK     2       // Refill once this many blocks or less are left
+#define KEYSTREAM_IV_LENGTH     3       // Random part of the counter block
+#define KEYSTREAM_NONCE_LENGTH  6       // IV and 24 bit counter, this is what the receiver needs to rebuild the block
+#define KEYSTREAM_LEASE         4096    // Counter values reserved in the key/value store ahead
+
+typedef struct {
+    uint8_t nonce[KEYSTREAM_NONCE_LENGTH];  // First bytes of the counter block, followed by the counter's top byte and zeros
+    uint8_t block[16];                      // Encrypted counter block
+} keystream_def;
+
+/**
+ * @brief Resume the block counter from the key/value store and write the first lease to flash
+ */
+void keystream_init(void);
+
+/**
+ * @brief Queue ECB jobs for every free slot of the keystream ring if it ran low
+ *
+ * @param key AES key for the keystream
+ * @param iv KEYSTREAM_IV_LENGTH random bytes for every free slot (KEYSTREAM_SIZE * KEYSTREAM_IV_LENGTH bytes)
+ */
+void keystream_refill(uint8_t key[16], uint8_t* iv);
+
+/**
+ * @brief Check if the keystream ring should be refilled
+ */
+bool keystream_low(void);
+
+/**
+ * @brief Take the next ready keystream block out of the ring
+ *
+ * @return false when there is no ready block
+ */
+bool keystream_take(keystream_def* keystream);
+
+#endif
@@ -0,0 +1,331 @@
+#include "nrf.h"
+#include "kv.h"
+#include "timer.h"
+#include "flash.h"
+#include "trace.h"
+#include "log.h"
+#include "compiler.h"
+
+#include <string.h>
+
+#define LOG_MODULE KV
+
+/*
+ * Log structured store over two flash pages. Only one page is active, new records are
+ * appended to it. Once it is full the latest record of every key is copied over to the
+ * other page which then becomes active.
+ *
+ *   page header   0x4B56 magic in the upper half, generation in the lower half
+ *   record        header word (key, length, CRC16 over key, length and data) followed by the data words
+ */
+
+#define ERASED          0xFFFFFFFF
+#define PAGE_MAGIC      0x4B56
+#define NO_RECORD       0
+
+#define RECORD_WORDS(length)    (1 + (((length) + 3) / 4))
+
+extern uint32_t __kv_start;
+
+static uint8_t active_page = 0xFF;                  // 0xFF while no page was formatted yet
+static uint16_t generation = 0;
+static uint16_t write_offset = 0;                   // Word offset of the next free record in the active page
+static uint16_t records[KV_KEY_COUNT];              // Word offset of the latest record per key
+
+static uint8_t pending[KV_KEY_COUNT][KV_MAX_LENGTH];
+static uint8_t pending_length[KV_KEY_COUNT];        // 0 when nothing is pending for the key
+
+// Flush in flight, the flash queue reads the records straight from the stage
+static uint32_t stage[KV_KEY_COUNT * RECORD_WORDS(KV_MAX_LENGTH)];
+static uint32_t stage_header;
+static bool staged[KV_KEY_COUNT];                   // Pending value of the key is part of the stage
+static bool flushing = false;
+static uint8_t flush_page;
+static uint16_t flush_offset;                       // Write offset once the flush is done
+static uint16_t flush_records[KV_KEY_COUNT];        // Record offsets once the flush is done
+
+static uint32_t kv_page_words(void)
+{
+    return NRF_FICR->CODEPAGESIZE / sizeof(uint32_t);
+}
+
+static volatile uint32_t* kv_page(uint8_t page)
+{
+    return ((volatile uint32_t*) &__kv_start) + (page * kv_page_words());
+}
+
+static uint16_t kv_crc(uint8_t key, uint8_t length, const uint8_t* data)
+{
+    // CRC-16/CCITT
+    uint16_t crc = 0xFFFF;
+    uint8_t header[2] = { key, length };
+
+    for (uint8_t i = 0; i < 2 + length; i++)
+    {
+        crc ^= (uint16_t) ((i < 2) ? header[i] : data[i - 2]) << 8;
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+        }
+    }
+
+    return crc;
+}
+
+static void kv_stage_record(uint16_t* words, uint8_t key, uint8_t length, const uint8_t* data)
+{
+    // Header goes first, a record cut by a reset is skipped by its CRC but keeps the log walkable
+    stage[(*words)++] = ((uint32_t) key << 24) | ((uint32_t) length << 16) | kv_crc(key, length, data);
+
+    for (uint8_t i = 0; i < length; i += 4)
+    {
+        uint32_t word = ERASED;
+        memcpy(&word, &data[i], (length - i < 4) ? (length - i) : 4);
+        stage[(*words)++] = word;
+    }
+}
+
+static bool kv_read_record(volatile uint32_t* page, uint16_t offset, uint8_t* key, uint8_t* length, uint8_t* data)
+{
+    uint32_t header = page[offset];
+    *key = (header >> 24) & 0xFF;
+    *length = (header >> 16) & 0xFF;
+
+    if (*length > KV_MAX_LENGTH || offset + RECORD_WORDS(*length) > kv_page_words())
+    {
+        return false;
+    }
+
+    memcpy(data, (const uint8_t*) &page[offset + 1], *length);
+    return kv_crc(*key, *length, data) == (header & 0xFFFF);
+}
+
+static bool kv_page_valid(uint8_t page)
+{
+    return (kv_page(page)[0] >> 16) == PAGE_MAGIC;
+}
+
+void kv_init(void)
+{
+    memset(records, NO_RECORD, sizeof(records));
+
+    // Newest generation wins, it also wins when a page switch got cut by a reset after the header was written
+    bool valid0 = kv_page_valid(0);
+    bool valid1 = kv_page_valid(1);
+    if (!valid0 && !valid1)
+    {
+        LOG_INFO("KV: No formatted page found");
+
+        return;
+    }
+
+    uint16_t generation0 = kv_page(0)[0] & 0xFFFF;
+    uint16_t generation1 = kv_page(1)[0] & 0xFFFF;
+    active_page = (!valid1 || (valid0 && (int16_t) (generation0 - generation1) > 0)) ? 0 : 1;
+    generation = (active_page == 0) ? generation0 : generation1;
+
+    volatile uint32_t* page = kv_page(active_page);
+    uint16_t offset = 1;
+    while (offset < kv_page_words() && page[offset] != ERASED)
+    {
+        uint8_t key;
+        uint8_t length;
+        uint8_t data[KV_MAX_LENGTH];
+        bool valid = kv_read_record(page, offset, &key, &length, data);
+
+        if (length > KV_MAX_LENGTH)
+        {
+            // Header itself is broken, nothing behind it can be trusted
+            offset = kv_page_words();
+            break;
+        }
+
+        if (valid && key < KV_KEY_COUNT)
+        {
+            records[key] = offset;
+        }
+
+        offset += RECORD_WORDS(length);
+    }
+    write_offset = offset;
+
+    LOG_INFO("KV: Page %u generation %u active, %u words used", active_page, generation, write_offset);
+}
+
+bool kv_get(kv_key key, void* data, uint8_t length)
+{
+    if (key >= KV_KEY_COUNT)
+    {
+        return false;
+    }
+
+    if (pending_length[key] != 0)
+    {
+        if (pending_length[key] != length)
+        {
+            return false;
+        }
+
+        memcpy(data, pending[key], length);
+        return true;
+    }
+
+    if (records[key] == NO_RECORD)
+    {
+        return false;
+    }
+
+    volatile uint32_t* page = kv_page(active_page);
+    if (((page[records[key]] >> 16) & 0xFF) != length)
+    {
+        return false;
+    }
+
+    memcpy(data, (const uint8_t*) &page[records[key] + 1], length);
+    return true;
+}
+
+void kv_set(kv_key key, const void* data, uint8_t length)
+{
+    if (key >= KV_KEY_COUNT || length == 0 || length > KV_MAX_LENGTH)
+    {
+        return;
+    }
+
+    memcpy(pending[key], data, length);
+    pending_length[key] = length;
+    staged[key] = false;
+}
+
+bool kv_pending(void)
+{
+    for (uint8_t key = 0; key < KV_KEY_COUNT; key++)
+    {
+        if (pending_length[key] != 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void kv_on_flushed(void)
+{
+    if (flush_page != active_page)
+    {
+        active_page = flush_page;
+        generation++;
+
+        TRACE_EVENT(TRACE_KV_SWITCHED, active_page, generation);
+    }
+
+    write_offset = flush_offset;
+    memcpy(records, flush_records, sizeof(records));
+
+    // Keys set again while the flush ran stay pending for the next one
+    for (uint8_t key = 0; key < KV_KEY_COUNT; key++)
+    {
+        if (staged[key])
+        {
+            staged[key] = false;
+            pending_length[key] = 0;
+        }
+    }
+
+    flushing = false;
+}
+
+void kv_flush(void)
+{
+    if (flushing || !kv_pending())
+    {
+        return;
+    }
+
+    uint16_t needed = 0;
+    for (uint8_t key = 0; key < KV_KEY_COUNT; key++)
+    {
+        if (pending_length[key] != 0)
+        {
+            needed += RECORD_WORDS(pending_length[key]);
+        }
+    }
+
+    // A full page moves to the other one, taking the latest value of every key along
+    bool switch_page = (active_page == 0xFF || write_offset + needed > kv_page_words());
+    if (flash_queue_free() < (switch_page ? 3 : 1))
+    {
+        return;
+    }
+
+    uint16_t words = 0;
+    if (switch_page)
+    {
+        flush_page = (active_page == 0xFF) ? 0 : (active_page ^ 1);
+        flush_offset = 1;
+
+        for (uint8_t key = 0; key < KV_KEY_COUNT; key++)
+        {
+            flush_records[key] = NO_RECORD;
+
+            // Pending values replace the stored ones anyway
+            if (pending_length[key] != 0 || records[key] == NO_RECORD)
+            {
+                continue;
+            }
+
+            uint8_t stored_key;
+            uint8_t length;
+            uint8_t data[KV_MAX_LENGTH];
+            if (kv_read_record(kv_page(active_page), records[key], &stored_key, &length, data))
+            {
+                flush_records[key] = flush_offset + words;
+                kv_stage_record(&words, key, length, data);
+            }
+        }
+    }
+    else
+    {
+        flush_page = active_page;
+        flush_offset = write_offset;
+        memcpy(flush_records, records, sizeof(records));
+    }
+
+    for (uint8_t key = 0; key < KV_KEY_COUNT; key++)
+    {
+        if (pending_length[key] != 0)
+        {
+            flush_records[key] = flush_offset + words;
+            kv_stage_record(&words, key, pending_length[key], pending[key]);
+            staged[key] = true;
+        }
+    }
+
+    volatile uint32_t* page = kv_page(flush_page);
+    if (switch_page)
+    {
+        // Header last, the old page stays valid until here
+        stage_header = ((uint32_t) PAGE_MAGIC << 16) | (uint16_t) (generation + 1);
+        flash_erase(page, NULL);
+        flash_write(&page[flush_offset], stage, words, NULL);
+        flash_write(&page[0], &stage_header, 1, kv_on_flushed);
+    }
+    else
+    {
+        flash_write(&page[flush_offset], stage, words, kv_on_flushed);
+    }
+
+    flush_offset += words;
+    flushing = true;
+
+    TRACE_EVENT(TRACE_KV_QUEUED, words, flush_page);
+}
+
+void kv_commit(void)
+{
+    // A flush which is already queued has to finish first, it makes kv_flush() a no-op
+    flash_drain();
+    kv_flush();
+    flash_drain();
+}
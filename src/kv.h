@@ -0,0 +1,58 @@
+#ifndef DOOR_KV_H__
+#define DOOR_KV_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define KV_MAX_LENGTH   16      // Maximum value length in bytes
+
+typedef enum {
+    KV_KEY_DEVICE_KEY = 0,      // 16 byte AES key
+    KV_KEY_DEVICE_ID,           // 10 byte device ident
+    KV_KEY_ADV_INTERVAL,        // uint32 seconds between adverts
+    KV_KEY_TX_POWER,            // int8 dBm
+    KV_KEY_LAST_TIME,           // uint32 last checkpointed time
+    KV_KEY_STATS,               // Statistics blob
+    KV_KEY_ACTIVATED,           // uint8 1 once the tag left ship mode, 0 keeps it in storage
+    KV_KEY_KEYSTREAM_COUNTER,   // uint32 CTR block counter reserved up to
+    KV_KEY_REBOOT_BASE,         // uint32 reboot counter base, survives the counter page erase
+    KV_KEY_CCM_COUNTER,         // uint32 CCM packet counter reserved up to
+    KV_KEY_COUNT
+} kv_key;
+
+/**
+ * @brief Find the active page and build the RAM index. Only reads flash.
+ */
+void kv_init(void);
+
+/**
+ * @brief Read the latest value of a key, values which are not flushed yet included
+ * 
+ * @return false when the key was never written or the stored length differs
+ */
+bool kv_get(kv_key key, void* data, uint8_t length);
+
+/**
+ * @brief Set a value. Only RAM is touched here, the value goes to flash with the next kv_flush().
+ * Setting a key again before that just replaces the pending value.
+ */
+void kv_set(kv_key key, const void* data, uint8_t length);
+
+/**
+ * @brief Check if there are values waiting for kv_flush()
+ */
+bool kv_pending(void);
+
+/**
+ * @brief Write all pending values to flash before returning. Blocks for the whole flash queue,
+ * only use this at boot before the radio starts.
+ */
+void kv_commit(void);
+
+/**
+ * @brief Queue all pending values for the flash scheduler. They stay pending until the
+ * write finished, a flush which is still running makes this a no-op.
+ */
+void kv_flush(void);
+
+#endif
@@ -0,0 +1,19 @@
+#include "nrf.h"
+#include "log.h"
+#include "timer.h"
+#include "rtt/SEGGER_RTT.h"
+
+#include <stdint.h>
+#include <stdarg.h>
+
+void log_printf(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+
+    SEGGER_RTT_printf(0, "%u> ", timer_get_seconds());
+    SEGGER_RTT_vprintf(0, format, &args);
+    SEGGER_RTT_WriteString(0, "\r\n");
+
+    va_end(args);
+}
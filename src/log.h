@@ -0,0 +1,81 @@
+#ifndef DOOR_LOG_H__
+#define DOOR_LOG_H__
+
+/*
+ * Text logging over RTT channel 0 with a compile time level per module. Every source file
+ * names its module once with `#define LOG_MODULE CLOCK` after its includes, LOG_ERROR(),
+ * LOG_INFO() and LOG_DEBUG() then log for that module:
+ *
+ *   LOG_INFO("TIMER: Added timer with interval %u to slot %u", interval, slot);
+ *
+ * The "seconds> " prefix and the line end are added. A statement below the module's level is
+ * a constant false branch, it still has to compile but no code, string or argument (not even
+ * the timer_get_seconds() of the prefix) ends up in the binary, at any optimisation level.
+ *
+ * Levels come from CMake (LOG_LEVEL_<MODULE>), a module left unset logs everything in a LOG
+ * (Debug) build and nothing otherwise. Use LOG_ENABLED() in #if for code that only exists
+ * to be logged.
+ */
+
+#define LOG_LEVEL_OFF       0
+#define LOG_LEVEL_ERROR     1
+#define LOG_LEVEL_INFO      2
+#define LOG_LEVEL_DEBUG     3       // Per event and interrupt, TRACE_EVENT() prints at this level
+
+#ifdef LOG
+#define LOG_LEVEL_DEFAULT   LOG_LEVEL_DEBUG
+#else
+#define LOG_LEVEL_DEFAULT   LOG_LEVEL_OFF
+#endif
+
+#ifndef LOG_LEVEL_CLOCK
+#define LOG_LEVEL_CLOCK     LOG_LEVEL_DEFAULT   // LFCLK/HFCLK
+#endif
+#ifndef LOG_LEVEL_TIMER
+#define LOG_LEVEL_TIMER     LOG_LEVEL_DEFAULT   // RTC1 slots
+#endif
+#ifndef LOG_LEVEL_BLE
+#define LOG_LEVEL_BLE       LOG_LEVEL_DEFAULT   // Radio, advertising chain, payload, motion
+#endif
+#ifndef LOG_LEVEL_AES
+#define LOG_LEVEL_AES       LOG_LEVEL_DEFAULT   // ECB, CCM, keystream
+#endif
+#ifndef LOG_LEVEL_RNG
+#define LOG_LEVEL_RNG       LOG_LEVEL_DEFAULT   // RNG peripheral, DRBG
+#endif
+#ifndef LOG_LEVEL_CORE
+#define LOG_LEVEL_CORE      LOG_LEVEL_DEFAULT   // Boot sequence in main
+#endif
+#ifndef LOG_LEVEL_REBOOT
+#define LOG_LEVEL_REBOOT    LOG_LEVEL_DEFAULT   // Reboot counter
+#endif
+#ifndef LOG_LEVEL_FLASH
+#define LOG_LEVEL_FLASH     LOG_LEVEL_DEFAULT   // Flash queue
+#endif
+#ifndef LOG_LEVEL_KV
+#define LOG_LEVEL_KV        LOG_LEVEL_DEFAULT   // Key/value store
+#endif
+#ifndef LOG_LEVEL_EPOCH
+#define LOG_LEVEL_EPOCH     LOG_LEVEL_DEFAULT   // Time checkpoints
+#endif
+#ifndef LOG_LEVEL_POWER
+#define LOG_LEVEL_POWER     LOG_LEVEL_DEFAULT   // Regulator, RAM, battery, ship mode, energy and idle reports
+#endif
+
+// Indirection so LOG_MODULE is replaced before pasting
+#define LOG_ENABLED(module, level)      LOG_ENABLED_(module, level)
+#define LOG_ENABLED_(module, level)     (LOG_LEVEL_##module >= (level))
+
+#define LOG_AT(level, ...) \
+    do { if (LOG_ENABLED(LOG_MODULE, level)) { log_printf(__VA_ARGS__); } } while (0)
+
+#define LOG_ERROR(...)      LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_INFO(...)       LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...)      LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+/**
+ * @brief Print one line with the seconds since boot in front, use the macros above instead
+ */
+void log_printf(const char* format, ...);
+
+#endif
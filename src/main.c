@@ -5,84 +5,111 @@
 #include "main.h"
 #include "random.h"
 #include "aes.h"
+#include "ccm.h"
+#include "payload.h"
 #include "ble_callback_chain.h"
 #include "aes_callback_chain.h"
 #include "pwr_mgmt.h"
+#include "idle.h"
+#include "battery.h"
+#include "energy.h"
+#include "ship.h"
+#include "motion.h"
 #include "reboot_counter.h"
+#include "flash.h"
+#include "kv.h"
+#include "epoch.h"
+#include "trace.h"
+#include "isr_timing.h"
+#include "log.h"
 #include "compiler.h"
 
 #include <string.h>
 #include <stdlib.h>
 
-#ifdef LOG
-#include "rtt/SEGGER_RTT.h"
-#endif
-
-RAM_CODE void sleep_for_interrupt()
-{
-  // Enter System ON sleep mode
-  __WFE();  
-  // Make sure any pending events are cleared
-  __SEV();
-  __WFE();
-}
+#define LOG_MODULE CORE
 
 void whenTimerInited(void)
 {
-  // Now we need a timer for sending this
+  // Now we need a timer for sending this, encryption piggy-backs on the adverts
   ble_callback_chain_register();
-  aes_callback_chain_register();
+
+  #ifdef MOTION
+  motion_init();
+  #endif
 }
 
 void whenClockInited(void) 
 {
+  // RTC0 for the energy ledger runs from LFCLK as well
+  #ifdef ENERGY
+  energy_init();
+  #endif
   timer_init(whenTimerInited);
 }
 
-RAM_CODE void idle()
-{
-  while(1)
-  {     
-    sleep_for_interrupt();
-  }
-}
-
 int main(void) 
 {
-  reboot_counter_init();
+  timer_boot_start();
 
-  #ifdef LOG
-  SEGGER_RTT_printf(0, "0> CORE: Booted up with reboot counter %u\r\n", reboot_counter_get());
+  #ifdef TRACE
+  trace_init();
   #endif
 
+  #ifdef ISR_TIMING_ENABLED
+  isr_timing_init();
+  #endif
+
+  flash_init();
+  kv_init();
+
+  // Tags in storage stop here, before anything is counted
+  #ifdef SHIP_MODE
+  ship_init();
+  #endif
+
+  reboot_counter_init();
+
+  // The boot word takes one 41us write, do it before the radio starts so reset loops are counted
+  flash_drain();
+
+  epoch_init();
+
+  // Epoch and key/value writes stay queued, the first advert is not held up by them and they go out in its radio free window
+
+  LOG_INFO("CORE: Booted up with reboot counter %u", reboot_counter_get());
+
   // Init timers
   clock_init(whenClockInited);
 
-  // Init crypto
-  random_init(aes_callback_chain_issue);
+  // Init crypto, the ECB has to be up first since the DRBG runs on it
+  aes_callback_chain_init();
   aes_init();
+  #if defined(PAYLOAD_MODE_CCM)
+  ccm_init();
+  #endif
+  random_init(aes_callback_chain_issue);
 
   // Generate PDU advertising packet
   uint8_t* adv_pdu = ble_get_adv_pdu();
   ble_pdu_init(adv_pdu);
 
-  // Add beacon data
-  static const uint8_t beacon_temp_only[31] = 
+  // Add beacon data, the payload is filled in once it is encrypted and nothing is sent before
+  static const uint8_t beacon_header[PAYLOAD_OFFSET] = 
   {
     0x02,
     0x01, 0x06,
-    0x1B,
-    0xFF, 0x59, 0x00, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA
+    3 + PAYLOAD_LENGTH,
+    0xFF, 0x59, 0x00
   };
-  memcpy(&adv_pdu[3 + M_BD_ADDR_SIZE], &(beacon_temp_only[0]), sizeof(beacon_temp_only));
-  adv_pdu[1] = M_BD_ADDR_SIZE + sizeof(beacon_temp_only);
+  memcpy(&adv_pdu[3 + M_BD_ADDR_SIZE], &(beacon_header[0]), sizeof(beacon_header));
+  adv_pdu[1] = M_BD_ADDR_SIZE + sizeof(beacon_header) + PAYLOAD_LENGTH;
 
   // Power management
   power_management_init();
+  battery_init();
 
-  #ifdef LOG
-  SEGGER_RTT_printf(0, "0> CORE: Power settings configured (LOWPWR and DCDC enable)\r\n");
-  #endif
+  LOG_INFO("CORE: Power settings configured (LOWPWR on LDO, DCDC per phase)");
   
-  idle();
+  idle_run();
 }
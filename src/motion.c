@@ -0,0 +1,112 @@
+#include "nrf.h"
+#include "motion.h"
+#include "ble_callback_chain.h"
+#include "timer.h"
+#include "trace.h"
+#include "compiler.h"
+
+#include <stdint.h>
+
+#define LOG_MODULE BLE
+
+/*
+ * The pin uses the GPIO SENSE mechanism and the GPIOTE PORT event, which needs no HFCLK and
+ * keeps the idle current at the sleep level. The sense polarity is flipped after every edge,
+ * otherwise a pin held at the active level would keep the PORT event firing.
+ */
+
+#define RTC_TICKS_PER_SECOND    8UL         // RTC1, see timer.c
+#define DEBOUNCE_TICKS          ((MOTION_DEBOUNCE_MS * RTC_TICKS_PER_SECOND) / 1000)
+
+static bool moving = false;
+static uint8_t edges = 0;                   // Debounced edges since the tag was stationary
+static uint32_t last_edge = 0;              // RTC ticks of the last counted edge
+static uint32_t sense;
+
+static void motion_sense(uint32_t level)
+{
+    sense = level;
+    NRF_GPIO->PIN_CNF[MOTION_PIN] = (GPIO_PIN_CNF_DIR_Input << GPIO_PIN_CNF_DIR_Pos)
+                                  | (GPIO_PIN_CNF_INPUT_Connect << GPIO_PIN_CNF_INPUT_Pos)
+                                  | (GPIO_PIN_CNF_PULL_Disabled << GPIO_PIN_CNF_PULL_Pos)
+                                  | (level << GPIO_PIN_CNF_SENSE_Pos);
+}
+
+static void motion_set_moving(bool state)
+{
+    moving = state;
+    ble_callback_chain_set_interval_scale(BLE_SCALE_MOTION, moving ? 1 : MOTION_STATIONARY_SCALE);
+
+    TRACE_EVENT(TRACE_MOTION, moving, 0);
+}
+
+RAM_CODE(GPIOTE_IRQHandler) void GPIOTE_IRQHandler(void)
+{
+    if (NRF_GPIOTE->EVENTS_PORT)
+    {
+        NRF_GPIOTE->EVENTS_PORT = 0;
+
+        // Wait for the pin to go back before the next event
+        motion_sense((sense == GPIO_PIN_CNF_SENSE_High) ? GPIO_PIN_CNF_SENSE_Low : GPIO_PIN_CNF_SENSE_High);
+
+        uint32_t now = timer_get_ticks();
+        if (edges > 0 && now - last_edge < DEBOUNCE_TICKS)
+        {
+            return;
+        }
+
+        last_edge = now;
+        if (edges < MOTION_TRIGGER_COUNT)
+        {
+            edges++;
+        }
+
+        if (!moving && edges >= MOTION_TRIGGER_COUNT)
+        {
+            motion_set_moving(true);
+
+            // Do not sit out the rest of the slow interval
+            ble_callback_chain_kick();
+        }
+    }
+}
+
+void motion_init(void)
+{
+    NVIC_DisableIRQ(GPIOTE_IRQn);
+
+    motion_sense(MOTION_ACTIVE_HIGH ? GPIO_PIN_CNF_SENSE_High : GPIO_PIN_CNF_SENSE_Low);
+    motion_set_moving(false);
+
+    NRF_GPIOTE->EVENTS_PORT = 0;
+    NRF_GPIOTE->INTENSET = GPIOTE_INTENSET_PORT_Msk;
+
+    NVIC_ClearPendingIRQ(GPIOTE_IRQn);
+    NVIC_EnableIRQ(GPIOTE_IRQn);
+    NVIC_SetPriority(GPIOTE_IRQn, 0);
+}
+
+RAM_CODE(motion_update) void motion_update(void)
+{
+    if (edges == 0)
+    {
+        return;
+    }
+
+    // Edges which did not add up to motion expire as well
+    if (timer_get_ticks() - last_edge < MOTION_HOLD_S * RTC_TICKS_PER_SECOND)
+    {
+        return;
+    }
+
+    edges = 0;
+    if (moving)
+    {
+        motion_set_moving(false);
+    }
+}
+
+bool motion_moving(void)
+{
+    return moving;
+}
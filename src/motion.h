@@ -0,0 +1,42 @@
+#ifndef DOOR_MOTION_H__
+#define DOOR_MOTION_H__
+
+#include <stdbool.h>
+
+#ifndef MOTION_PIN
+#define MOTION_PIN                  4       // Interrupt output of the accelerometer
+#endif
+
+#ifndef MOTION_ACTIVE_HIGH
+#define MOTION_ACTIVE_HIGH          1       // 0 when the accelerometer pulls the pin low on motion
+#endif
+
+#ifndef MOTION_DEBOUNCE_MS
+#define MOTION_DEBOUNCE_MS          250     // Edges closer than this count once
+#endif
+
+#ifndef MOTION_TRIGGER_COUNT
+#define MOTION_TRIGGER_COUNT        2       // Edges within MOTION_HOLD_S before the tag counts as moving
+#endif
+
+#ifndef MOTION_HOLD_S
+#define MOTION_HOLD_S               30      // Seconds without motion before the tag counts as stationary again
+#endif
+
+#ifndef MOTION_STATIONARY_SCALE
+#define MOTION_STATIONARY_SCALE     10      // Advertising interval multiplier while stationary
+#endif
+
+/**
+ * @brief Configure the motion pin and the GPIOTE port interrupt. The tag starts out as stationary.
+ */
+void motion_init(void);
+
+/**
+ * @brief Called at every advertising event, falls back to the stationary rate once the hold time ran out
+ */
+void motion_update(void);
+
+bool motion_moving(void);
+
+#endif
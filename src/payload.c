@@ -0,0 +1,76 @@
+#include "payload.h"
+#include "ble.h"
+#include "timer.h"
+#include "epoch.h"
+#include "trace.h"
+#include "compiler.h"
+
+#include <string.h>
+
+#define LOG_MODULE BLE
+
+typedef struct {
+    uint32_t time;
+    uint8_t data[PAYLOAD_LENGTH];
+} payload_def;
+
+static payload_def payloads[PAYLOAD_BATCH_SIZE];
+static uint8_t payloads_head = 0;
+static uint8_t payloads_count = 0;
+static bool applied = false;                        // PDU holds a payload which may be sent
+
+void payload_push(uint32_t time, uint8_t data[PAYLOAD_LENGTH])
+{
+    // A full ring drops its oldest payload, it would be outdated first anyway
+    if (payloads_count == PAYLOAD_BATCH_SIZE)
+    {
+        payloads_head = (payloads_head + 1) % PAYLOAD_BATCH_SIZE;
+        payloads_count--;
+    }
+
+    payload_def* payload = &payloads[(payloads_head + payloads_count) % PAYLOAD_BATCH_SIZE];
+    payload->time = time;
+    memcpy(payload->data, data, PAYLOAD_LENGTH);
+    payloads_count++;
+}
+
+RAM_CODE(payload_apply) bool payload_apply(uint8_t* adv_pdu)
+{
+    uint32_t now = epoch_get();
+    payload_def* newest = NULL;
+
+    // Skip over every payload which is already due and keep the last of them
+    while (payloads_count > 0 && payloads[payloads_head].time <= now)
+    {
+        newest = &payloads[payloads_head];
+        payloads_head = (payloads_head + 1) % PAYLOAD_BATCH_SIZE;
+        payloads_count--;
+    }
+
+    if (newest == NULL)
+    {
+        return false;
+    }
+
+    memcpy(&adv_pdu[3 + M_BD_ADDR_SIZE + PAYLOAD_OFFSET], newest->data, PAYLOAD_LENGTH);
+    applied = true;
+
+    TRACE_EVENT(TRACE_PAYLOAD_APPLIED, newest->time, payloads_count);
+
+    return true;
+}
+
+RAM_CODE(payload_ready) bool payload_ready(void)
+{
+    return applied;
+}
+
+uint8_t payload_count(void)
+{
+    return payloads_count;
+}
+
+uint32_t payload_last_time(void)
+{
+    return payloads[(payloads_head + payloads_count - 1) % PAYLOAD_BATCH_SIZE].time;
+}
@@ -0,0 +1,53 @@
+#ifndef DOOR_PAYLOAD_H__
+#define DOOR_PAYLOAD_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PAYLOAD_OFFSET      7       // Offset of the payload behind the BD addr (flags, length, type and company id)
+
+#if defined(PAYLOAD_MODE_CCM)
+#define PAYLOAD_VERSION     0x02    // Versioned payloads are one byte shorter than the legacy one
+#define PAYLOAD_LENGTH      23      // Version, 4 bytes counter, 8 bytes IV, 6 bytes encrypted data and 4 bytes MIC
+#elif defined(PAYLOAD_MODE_CTR)
+#define PAYLOAD_VERSION     0x03
+#define PAYLOAD_LENGTH      23      // Version, 3 bytes IV, 3 bytes counter and 16 bytes encrypted data
+#else
+#define PAYLOAD_LENGTH      24      // 8 bytes IV and 16 bytes encrypted data
+#endif
+
+#define PAYLOAD_BATCH_SIZE  8       // Number of payloads which are encrypted ahead
+#define PAYLOAD_WATERMARK   2       // Refill the payloads during an advert once this many or less are left
+
+/**
+ * @brief Store an encrypted payload which should be advertised at the given time
+ *
+ * @param time timestamp (in timer seconds) encrypted into the payload. Payloads have to be pushed in ascending order
+ * @param data payload as it is put into the advertising data
+ */
+void payload_push(uint32_t time, uint8_t data[PAYLOAD_LENGTH]);
+
+/**
+ * @brief Put the newest payload whose timestamp is not in the future into the advertising PDU.
+ * Older payloads are dropped, so the timestamp in the air never goes backwards.
+ *
+ * @return true when the PDU got a new payload, false when it keeps the previous one
+ */
+bool payload_apply(uint8_t* adv_pdu);
+
+/**
+ * @brief Check if the PDU holds a payload which may be sent. False until the first payload was applied.
+ */
+bool payload_ready(void);
+
+/**
+ * @brief Get the number of payloads still waiting to be advertised
+ */
+uint8_t payload_count(void);
+
+/**
+ * @brief Get the timestamp of the newest payload waiting to be advertised, only valid when payload_count() > 0
+ */
+uint32_t payload_last_time(void);
+
+#endif
@@ -1,18 +1,171 @@
 #include "nrf.h"
+#include "hal.h"
+#include "pwr_mgmt.h"
+#include "battery.h"
+#include "energy.h"
+#include "log.h"
 #include "compiler.h"
 
-#define NRF52_ONRAM0_OFFRAM0    POWER_RAM_POWER_S0POWER_Off     << POWER_RAM_POWER_S0POWER_Pos      \
-							  | POWER_RAM_POWER_S1POWER_Off     << POWER_RAM_POWER_S1POWER_Pos;
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LOG_MODULE POWER
+
+/*
+ * The firmware keeps .data with the RAM_CODE copies, .bss and the heap from __ram_start up to
+ * __HeapLimit and the stack reservation from __StackLimit to __StackTop at the top of the RAM
+ * region, nrf_common.ld fails the build when they overlap. Only sections holding one of these
+ * stay powered, which in System ON is what keeps them retained. The gap between heap and stack
+ * and everything behind the RAM region is powered off.
+ */
+
+/*
+ * Regulator and sub power mode follow the phase the chains are in. The DC/DC converter only
+ * beats the LDO at mA loads and has a start up cost of its own, so it runs while the radio
+ * sends or the NVMC writes and the tag sleeps on the LDO. Constant latency keeps the wake up
+ * from the radio interrupts short while hopping channels and costs standby current, so it is
+ * only used for the radio. ECB and CCM mostly run inside the radio window, on their own they
+ * are too short for the converter to pay back its start.
+ */
+
+#define POWER_DCDC_START_NC     2       // Charge to get the converter going, rough estimate
+
+typedef struct {
+    bool dcdc;
+    bool constlat;
+} power_profile_def;
+
+static const power_profile_def profiles[POWER_PHASE_COUNT] = {
+    { true, true },                     // Radio
+    { true, false },                    // Flash, the CPU stalls anyway
+};
+
+static uint8_t phases = 0;              // Bit per running phase
+static bool dcdc = false;
+static bool constlat = false;
+static power_stats_def stats;
+
+extern uint32_t __ram_start;
+extern uint32_t __HeapLimit;
+extern uint32_t __StackLimit;
+extern uint32_t __StackTop;
+
+static bool power_ram_overlaps(uint32_t start, uint32_t end, uint32_t used_start, uint32_t used_end)
+{
+    return start < used_end && used_start < end;
+}
+
+static void power_ram_init(void)
+{
+    // Sections are counted from the start of RAM, which is where the RAM region starts as well
+    uint32_t low_end = (uint32_t) &__HeapLimit - (uint32_t) &__ram_start;
+    uint32_t stack_start = (uint32_t) &__StackLimit - (uint32_t) &__ram_start;
+    uint32_t stack_end = (uint32_t) &__StackTop - (uint32_t) &__ram_start;
+    uint32_t used = low_end + (stack_end - stack_start);
+
+    uint32_t sections = hal_ram_sections();
+    uint32_t section_size = hal_ram_section_size();
+    uint32_t off = 0;
+
+    for (uint32_t section = 0; section < sections; section++)
+    {
+        uint32_t start = section * section_size;
+        uint32_t end = start + section_size;
+
+        if (!power_ram_overlaps(start, end, 0, low_end) && !power_ram_overlaps(start, end, stack_start, stack_end))
+        {
+            hal_ram_off(section);
+            off++;
+        }
+    }
+
+    LOG_INFO("POWER: %u bytes of RAM used (%u data, bss and heap, %u stack), powered off %u of %u RAM sections",
+        used, low_end, stack_end - stack_start, off, sections);
+}
+
+RAM_CODE(power_apply) static void power_apply(void)
+{
+    bool want_dcdc = false;
+    bool want_constlat = false;
+    for (uint8_t phase = 0; phase < POWER_PHASE_COUNT; phase++)
+    {
+        if (phases & (1 << phase))
+        {
+            want_dcdc |= profiles[phase].dcdc;
+            want_constlat |= profiles[phase].constlat;
+        }
+    }
+
+    // Nothing sampled yet reads as 0, on nRF51 the first event runs on the LDO
+    if (HAL_DCDC_MIN_MV > 0 && battery_mv() < HAL_DCDC_MIN_MV)
+    {
+        want_dcdc = false;
+    }
+
+    if (want_dcdc != dcdc)
+    {
+        dcdc = want_dcdc;
+        NRF_POWER->DCDCEN = dcdc ? 1 : 0;
+        stats.dcdc_switches++;
+
+        if (dcdc)
+        {
+            ENERGY_ADD_CHARGE(ENERGY_POWER, POWER_DCDC_START_NC);
+        }
+    }
+
+    if (want_constlat != constlat)
+    {
+        constlat = want_constlat;
+        stats.constlat_switches++;
+
+        if (constlat)
+        {
+            NRF_POWER->TASKS_CONSTLAT = 1;
+            ENERGY_START(ENERGY_POWER);
+        }
+        else
+        {
+            NRF_POWER->TASKS_LOWPWR = 1;
+            ENERGY_STOP(ENERGY_POWER);
+        }
+    }
+}
+
+RAM_CODE(power_phase_start) void power_phase_start(power_phase phase)
+{
+    // The flash phase changes from the idle loop, the radio phase from interrupts
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    phases |= (1 << phase);
+    power_apply();
+
+    __set_PRIMASK(primask);
+}
+
+RAM_CODE(power_phase_stop) void power_phase_stop(power_phase phase)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    phases &= ~(1 << phase);
+    power_apply();
+
+    __set_PRIMASK(primask);
+}
+
+const power_stats_def* power_stats(void)
+{
+    return &stats;
+}
 
 void power_management_init() 
 {
-    // We set some basic power saving measures here
-    // We enable low power CPU mode, DC/DC regulator
+    // Sleep in low power mode on the LDO, the phases switch up when needed
     NRF_POWER->TASKS_LOWPWR = 1;
-    NRF_POWER->DCDCEN = 1;
+    NRF_POWER->DCDCEN = 0;
 
     // Turn off RAM we don't need
-    NRF_POWER->RAM[1].POWER = NRF52_ONRAM0_OFFRAM0;
-    NRF_POWER->RAM[2].POWER = NRF52_ONRAM0_OFFRAM0;
-    NRF_POWER->RAM[3].POWER = NRF52_ONRAM0_OFFRAM0;
-}
\ No newline at end of file
+    power_ram_init();
+}
@@ -1,6 +1,31 @@
 #ifndef DOOR_PWR_MGMT_H_
 #define DOOR_PWR_MGMT_H_
 
+#include <stdint.h>
+
+typedef enum {
+    POWER_PHASE_RADIO = 0,              // HFCLK up for an advertising event
+    POWER_PHASE_FLASH,                  // NVMC working off the flash queue
+    POWER_PHASE_COUNT
+} power_phase;
+
+typedef struct {
+    uint32_t dcdc_switches;
+    uint32_t constlat_switches;
+} power_stats_def;
+
 void power_management_init();
 
+/**
+ * @brief Switch regulator and power mode for a phase, phases can overlap
+ */
+void power_phase_start(power_phase phase);
+
+/**
+ * @brief Phase is over, drops back to low power on the LDO once no other phase needs more
+ */
+void power_phase_stop(power_phase phase);
+
+const power_stats_def* power_stats(void);
+
 #endif
\ No newline at end of file
@@ -1,45 +1,106 @@
 #include "nrf.h"
 #include "random.h"
+#include "drbg.h"
 #include "timer.h"
+#include "energy.h"
+#include "trace.h"
+#include "isr_timing.h"
+#include "log.h"
 #include "compiler.h"
 
+#include <stddef.h>
 #include <string.h>
-#include <stdlib.h>
 
-#ifdef LOG
-#include "rtt/SEGGER_RTT.h"
-#endif
+#define LOG_MODULE RNG
 
-static uint8_t value[8];                            // We only generate IVs 8 bytes long
-static uint8_t index = 0;
+static uint8_t pool[RANDOM_POOL_SIZE];
+static uint8_t pool_head = 0;                       // Oldest fresh byte
+static uint8_t pool_count = 0;                      // Fresh bytes in the pool
 static void (*onFirstDataCB)();
 
+static uint8_t seed[DRBG_SEED_LENGTH];              // Entropy from the hardware RNG for the next reseed
+static uint8_t seed_count = 0;
+static bool rng_running = false;
+static uint32_t rng_bytes = 0;                      // Bytes taken from the hardware RNG since boot
+
+
+static void random_rng_start(void)
+{
+    rng_running = true;
+    NRF_RNG->TASKS_START = 1;
+    ENERGY_START(ENERGY_RNG);
+}
+
 void RNG_IRQHandler(void)
 {
-    #ifdef LOG
-    SEGGER_RTT_printf(0, "%u> RNG: Interrupt\r\n", timer_get_seconds());
-    #endif
+    ISR_TIMING_ENTER(ISR_RNG);
+    TRACE_EVENT(TRACE_RNG_IRQ, 0, 0);
 
     if (NRF_RNG->EVENTS_VALRDY) 
     {
         NRF_RNG->EVENTS_VALRDY = 0;
-        value[index++] = NRF_RNG->VALUE;
+        seed[seed_count++] = NRF_RNG->VALUE;
+        rng_bytes++;
 
-        if (index == 8)
+        if (seed_count == DRBG_SEED_LENGTH)
         {
-            #ifdef LOG
-            SEGGER_RTT_printf(0, "%u> RNG: Generated 8 bytes. Stopping RNG\r\n", timer_get_seconds());
-            #endif
+            TRACE_EVENT(TRACE_RNG_SEEDED, rng_bytes, 0);
 
             NRF_RNG->TASKS_STOP = 1;
+            rng_running = false;
+            ENERGY_STOP(ENERGY_RNG);
 
-            if (onFirstDataCB != NULL) 
-            {
-                onFirstDataCB();
-                onFirstDataCB = NULL;
-            }
+            random_refill();
         }
     }
+
+    ISR_TIMING_EXIT(ISR_RNG);
+}
+
+static void on_random_block(uint8_t block[16])
+{
+    for (uint8_t i = 0; i < 16 && pool_count < RANDOM_POOL_SIZE; i++)
+    {
+        pool[(pool_head + pool_count) % RANDOM_POOL_SIZE] = block[i];
+        pool_count++;
+    }
+}
+
+void random_refill(void)
+{
+    // Something is already on its way and calls us again once done
+    if (rng_running || drbg_busy())
+    {
+        return;
+    }
+
+    // Only the seed comes from the hardware RNG, everything else from the DRBG
+    if (drbg_needs_reseed())
+    {
+        if (seed_count < DRBG_SEED_LENGTH)
+        {
+            random_rng_start();
+        }
+        else if (drbg_reseed(seed, random_refill))
+        {
+            memset(seed, 0, DRBG_SEED_LENGTH);
+            seed_count = 0;
+        }
+        return;
+    }
+
+    if (pool_count + (DRBG_BLOCKS_PER_REQUEST * 16) > RANDOM_POOL_SIZE)
+    {
+        if (onFirstDataCB != NULL) 
+        {
+            void (*cb)() = onFirstDataCB;
+            onFirstDataCB = NULL;
+            cb();
+        }
+        return;
+    }
+
+    drbg_generate(on_random_block, random_refill);
 }
 
 void random_init(void (*cb)()) 
@@ -48,24 +109,49 @@ void random_init(void (*cb)())
 
     NVIC_DisableIRQ(RNG_IRQn);
 
-    NRF_RNG->CONFIG = RNG_CONFIG_DERCEN_Msk;        // Bias correction
+    NRF_RNG->CONFIG = RNG_CONFIG_DERCEN_Msk;        // Bias correction, only the seed comes from here so it may be slow
     NRF_RNG->INTENSET = RNG_INTENSET_VALRDY_Msk;    
 
     NVIC_ClearPendingIRQ(RNG_IRQn);
     NVIC_EnableIRQ(RNG_IRQn);
     NVIC_SetPriority(RNG_IRQn, 0);
 
-    NRF_RNG->TASKS_START = 1;
+    random_refill();
 }
 
-uint8_t* random_get(void) 
+uint8_t random_available(void)
 {
-    uint8_t* data = (uint8_t*) malloc(8 * sizeof(uint8_t));
-    memcpy(data, value, 8);
+    return pool_count;
+}
 
-    // Reset and generate new bytes
-    index = 0;
-    NRF_RNG->TASKS_START = 1;
+bool random_fill(uint8_t* data, uint8_t length)
+{
+    if (length > pool_count)
+    {
+        TRACE_EVENT(TRACE_RNG_SHORT, pool_count, length);
 
-    return data;
-}
\ No newline at end of file
+        random_refill();
+        return false;
+    }
+
+    for (uint8_t i = 0; i < length; i++)
+    {
+        data[i] = pool[pool_head];
+        pool_head = (pool_head + 1) % RANDOM_POOL_SIZE;
+    }
+    pool_count -= length;
+
+    // Refill in one burst instead of keeping the generator running all the time
+    if (pool_count < RANDOM_LOW_WATERMARK)
+    {
+        random_refill();
+    }
+
+    return true;
+}
+
+void random_report(void)
+{
+    // The RNG only runs for the DRBG seed, this stays at a few bytes per reseed
+    LOG_INFO("RNG: %u bytes from the hardware RNG since boot", rng_bytes);
+}
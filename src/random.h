@@ -1,18 +1,48 @@
 #ifndef DOOR_RANDOM_H__
 #define DOOR_RANDOM_H__
 
+#include <stdint.h>
+#include <stdbool.h>
+
+#define RANDOM_POOL_SIZE        64      // Enough for one 8 byte IV per payload of a full batch
+#define RANDOM_LOW_WATERMARK    32      // The RNG is started again once less bytes are left
+
+/*
+ * Random data is generated by a CTR_DRBG on the ECB. The hardware RNG only runs to collect
+ * its seed, once at boot and then every DRBG_RESEED_INTERVAL requests.
+ */
+
 /**
- * @brief Init the random hardware
+ * @brief Init the random hardware, seed the DRBG and fill the pool
  * 
- * @param cb callback which gets called when hardware is ready and has at least generates 8 bytes of random data
+ * @param cb callback which gets called when hardware is ready and the pool is filled for the first time
  */
 void random_init(void (*cb)());
 
 /**
- * @brief Get the current random values. The internal generation will start afterwards and roll over the random data again until 8 new bytes are populated
+ * @brief Get the number of fresh random bytes in the pool
+ */
+uint8_t random_available(void);
+
+/**
+ * @brief Take fresh random bytes out of the pool. Bytes are never handed out twice, the DRBG refills
+ * the pool in the background once it drops below RANDOM_LOW_WATERMARK
  * 
- * @return uint8_t* pointer to a uint8 array with 8 items
+ * @param data buffer to fill
+ * @param length number of bytes needed
+ * @return false when the pool does not have enough fresh bytes, nothing is taken then
+ */
+bool random_fill(uint8_t* data, uint8_t length);
+
+/**
+ * @brief Make sure the pool is being topped up. random_fill() does this by itself, call it when
+ * a caller found too few bytes and takes nothing. Does nothing while a refill is on its way.
+ */
+void random_refill(void);
+
+/**
+ * @brief Print the number of bytes taken from the hardware RNG since boot over RTT, does nothing below LOG_LEVEL_INFO for RNG
  */
-uint8_t* random_get(void);
+void random_report(void);
 
-#endif
\ No newline at end of file
+#endif
@@ -1,50 +1,139 @@
 #include "nrf.h"
 #include "reboot_counter.h"
+#include "flash.h"
+#include "kv.h"
+#include "log.h"
 #include "compiler.h"
 
-#ifdef LOG
-#include "rtt/SEGGER_RTT.h"
-#endif
+#include <stddef.h>
 
-void reboot_counter_init()
+#define LOG_MODULE REBOOT
+
+/*
+ * The counter lives in a dedicated flash page used as an append only log:
+ *
+ *   word 0        base value, the counter when the page was erased last
+ *   word 1..n-1   one word per boot, written to 0 when used
+ *
+ * The current value is the base plus the number of used words. A boot only has to write a
+ * single word, the page is erased once every n-1 boots.
+ *
+ * Before that erase the new base goes to the key/value store. A brown out between the erase
+ * and the base rewrite leaves an erased or half erased page, the value is then never below
+ * the copy in the key/value store. A base word more than a page of boots ahead of the copy
+ * is left over from such an erase and is not trusted either.
+ */
+
+#define ERASED          0xFFFFFFFF
+
+extern uint32_t __reboot_counter_start;
+
+static uint32_t counter = 0;
+static const uint32_t used = 0;                     // Marks a boot word as used
+
+static void reboot_counter_restart(volatile uint32_t* page)
 {
-    // Get the "old" value
-    uint32_t value = reboot_counter_get();
-
-    #ifdef LOG
-    SEGGER_RTT_printf(0, "0> REBOOT: Current stored reboot counter %u\r\n", value);
-    #endif
-
-    // Enable write
-    NRF_NVMC->CONFIG = NVMC_CONFIG_WEN_Een << NVMC_CONFIG_WEN_Pos;
-    while (NRF_NVMC->READY == NVMC_READY_READY_Busy);
-    
-    NRF_NVMC->ERASEUICR = 1;
-    while (NRF_NVMC->READY == NVMC_READY_READY_Busy);  
-
-    NRF_NVMC->CONFIG = NVMC_CONFIG_WEN_Wen << NVMC_CONFIG_WEN_Pos;
-    while (NRF_NVMC->READY == NVMC_READY_READY_Busy);
-
-    value++;
-
-    #ifdef LOG
-    SEGGER_RTT_printf(0, "0> REBOOT: Want to store reboot counter %u\r\n", value);
-    #endif
-
-    NRF_UICR->CUSTOMER[0] = value;
-    while (NRF_NVMC->READY == NVMC_READY_READY_Busy);  
-    
-    // Read only again
-    NRF_NVMC->CONFIG = NVMC_CONFIG_WEN_Ren << NVMC_CONFIG_WEN_Pos;
-    while (NRF_NVMC->READY == NVMC_READY_READY_Busy){}
+    // Start over with the current value as base. The queue runs in order, so the copy in the
+    // key/value store is written before the erase starts
+    uint8_t free = flash_queue_free();
+    kv_set(KV_KEY_REBOOT_BASE, &counter, sizeof(counter));
+    kv_flush();
+
+    if (flash_queue_free() < free)
+    {
+        flash_erase(page, NULL);
+        flash_write(&page[0], &counter, 1, NULL);
+
+        LOG_INFO("REBOOT: Erasing counter page, new base %u", counter);
+    }
+    else
+    {
+        // The copy is still pending and counts this boot, erase on the next one
+        LOG_ERROR("REBOOT: Could not queue the counter base, erase postponed");
+    }
 }
 
-uint32_t reboot_counter_get()
+void reboot_counter_init()
 {
-    if (NRF_UICR->CUSTOMER[0] == 0xFFFFFFFF)
+    volatile uint32_t* page = (volatile uint32_t*) &__reboot_counter_start;
+    uint32_t words = NRF_FICR->CODEPAGESIZE / sizeof(uint32_t);
+
+    uint32_t base = 0;
+    bool saved = kv_get(KV_KEY_REBOOT_BASE, &base, sizeof(base));
+
+    if (page[0] == ERASED)
     {
-        return 0;
+        // Fresh page or an erase cut short, else take over the value older firmware kept in the UICR
+        if (saved)
+        {
+            counter = base;
+        }
+        else
+        {
+            counter = (NRF_UICR->CUSTOMER[0] == ERASED) ? 0 : NRF_UICR->CUSTOMER[0];
+        }
+        counter++;
+        flash_write(&page[0], &counter, 1, NULL);
+
+        LOG_INFO("REBOOT: Initialized counter page with %u", counter);
+
+        return;
     }
 
-    return NRF_UICR->CUSTOMER[0];
-}
\ No newline at end of file
+    if (saved && page[0] > base + words)
+    {
+        counter = base + 1;
+        reboot_counter_restart(page);
+
+        LOG_ERROR("REBOOT: Counter page base 0x%x is not valid, resuming from the stored copy", page[0]);
+
+        return;
+    }
+
+    // Used words are always in front of the free ones, so search for the first free one
+    uint32_t low = 1;
+    uint32_t high = words;
+    while (low < high)
+    {
+        uint32_t middle = low + ((high - low) / 2);
+        if (page[middle] == ERASED)
+        {
+            high = middle;
+        }
+        else
+        {
+            low = middle + 1;
+        }
+    }
+
+    counter = page[0] + (low - 1);
+    if (saved && base > counter)
+    {
+        counter = base;
+    }
+
+    LOG_INFO("REBOOT: Current stored reboot counter %u", counter);
+
+    counter++;
+
+    if (low < words)
+    {
+        flash_write(&page[low], &used, 1, NULL);
+    }
+    else
+    {
+        reboot_counter_restart(page);
+    }
+}
+
+bool reboot_counter_used()
+{
+    volatile uint32_t* page = (volatile uint32_t*) &__reboot_counter_start;
+    uint32_t base;
+    return page[0] != ERASED || kv_get(KV_KEY_REBOOT_BASE, &base, sizeof(base)) || NRF_UICR->CUSTOMER[0] != ERASED;
+}
+
+uint32_t reboot_counter_get()
+{
+    return counter;
+}
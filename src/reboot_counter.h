@@ -1,7 +1,18 @@
 #ifndef DOOR_REBOOT_COUNTER_H_
 #define DOOR_REBOOT_COUNTER_H_
 
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Count this boot. The flash writes are only queued, flash_drain() them before the radio starts.
+ */
 void reboot_counter_init();
 uint32_t reboot_counter_get();
 
+/**
+ * @brief Check if the counter was ever written, before reboot_counter_init()
+ */
+bool reboot_counter_used();
+
 #endif
\ No newline at end of file
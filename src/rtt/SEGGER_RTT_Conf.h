@@ -92,7 +92,11 @@ Revision: $Rev: 24316 $
 #endif
 
 #ifndef   BUFFER_SIZE_UP
+  #if defined(TRACE) && !defined(LOG) && !defined(LOG_LEVELS)
+  #define BUFFER_SIZE_UP                            (16)    // Terminal is unused with only the binary trace, it has a buffer of its own (trace.h)
+  #else
   #define BUFFER_SIZE_UP                            (1024)  // Size of the buffer for terminal output of target, up to host (Default: 1k)
+  #endif
 #endif
 
 #ifndef   BUFFER_SIZE_DOWN
@@ -0,0 +1,80 @@
+#include "nrf.h"
+#include "ship.h"
+#include "hal.h"
+#include "kv.h"
+#include "reboot_counter.h"
+#include "log.h"
+#include "compiler.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LOG_MODULE POWER
+
+/*
+ * A tag leaves production without the activated flag in the key/value store and sleeps in
+ * System OFF. Waking up from System OFF is a reset with the OFF bit in RESETREAS, only then
+ * the flag gets set. Storage boots return before the reboot counter or the epoch are touched.
+ *
+ * A flag stored as 0 keeps the tag in storage until such a wake up. Only a missing flag falls
+ * back to the reboot counter, which tells tags that ran older firmware from new ones.
+ */
+
+static void ship_system_off(void)
+{
+    NRF_GPIO->PIN_CNF[SHIP_WAKE_PIN] = (GPIO_PIN_CNF_DIR_Input << GPIO_PIN_CNF_DIR_Pos)
+                                     | (GPIO_PIN_CNF_INPUT_Connect << GPIO_PIN_CNF_INPUT_Pos)
+                                     | (GPIO_PIN_CNF_PULL_Pullup << GPIO_PIN_CNF_PULL_Pos)
+                                     | (GPIO_PIN_CNF_SENSE_Low << GPIO_PIN_CNF_SENSE_Pos);
+
+    #if defined(NRF_NFCT)
+    NRF_NFCT->TASKS_SENSE = 1;
+    #endif
+
+    // The wake up is a reset, nothing in RAM has to survive
+    for (uint32_t section = 0; section < hal_ram_sections(); section++)
+    {
+        hal_ram_retention_off(section);
+    }
+
+    LOG_INFO("SHIP: Entering System OFF, wake up with pin %u", SHIP_WAKE_PIN);
+
+    NRF_POWER->SYSTEMOFF = POWER_SYSTEMOFF_SYSTEMOFF_Enter << POWER_SYSTEMOFF_SYSTEMOFF_Pos;
+
+    // System OFF only takes effect once the CPU stops, the wake up is a reset
+    while (true)
+    {
+        __WFE();
+    }
+}
+
+void ship_init(void)
+{
+    uint32_t reason = NRF_POWER->RESETREAS;
+    NRF_POWER->RESETREAS = reason;
+
+    uint8_t activated = 0;
+    bool stored = kv_get(KV_KEY_ACTIVATED, &activated, sizeof(activated));
+    if (activated)
+    {
+        return;
+    }
+
+    #if defined(POWER_RESETREAS_NFC_Msk)
+    bool woken = (reason & (POWER_RESETREAS_OFF_Msk | POWER_RESETREAS_NFC_Msk)) != 0;
+    #else
+    bool woken = (reason & POWER_RESETREAS_OFF_Msk) != 0;
+    #endif
+
+    // Firmware without ship mode never set the flag, a used reboot counter shows the tag is in the field already
+    if (woken || (!stored && reboot_counter_used()))
+    {
+        LOG_INFO("SHIP: Activated (reset reason 0x%x)", reason);
+
+        activated = 1;
+        kv_set(KV_KEY_ACTIVATED, &activated, sizeof(activated));
+        return;
+    }
+
+    ship_system_off();
+}
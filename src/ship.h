@@ -0,0 +1,15 @@
+#ifndef DOOR_SHIP_H__
+#define DOOR_SHIP_H__
+
+#ifndef SHIP_WAKE_PIN
+#define SHIP_WAKE_PIN   3       // Pulled low to wake the tag out of storage
+#endif
+
+/**
+ * @brief Check at boot if the tag was activated. A tag which was not goes to System OFF right here
+ * and only comes back through the wake pin (or an NFC field on nRF52), which activates it.
+ * Has to run after kv_init() and before anything else touches flash.
+ */
+void ship_init(void);
+
+#endif
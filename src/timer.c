@@ -2,11 +2,12 @@
 
 #include "nrf.h"
 #include "timer.h"
+#include "trace.h"
+#include "isr_timing.h"
+#include "log.h"
 #include "compiler.h"
 
-#ifdef LOG
-#include "rtt/SEGGER_RTT.h"
-#endif
+#define LOG_MODULE TIMER
 
 // RTC stuff
 #define LFCLK_FREQUENCY           (32768UL)                               // Low freq according to (nRF 51822 spec v3.3, 3.6, LFCLK). This freq is used by RTC (nRF 51822 spec v3.3, 4.3)
@@ -21,6 +22,17 @@ typedef struct {
 timer_def* slots[4];
 uint8_t current_slot = 0;
 uint32_t overflow_seconds = 0;
+static uint32_t boot_ms = 0;                                                        // From main() until RTC1 started, LFCLK start up included
+
+void timer_boot_start(void)
+{
+    // RTC1 needs LFCLK, until that runs the time since reset is counted on HFCLK
+    NRF_TIMER1->MODE = TIMER_MODE_MODE_Timer << TIMER_MODE_MODE_Pos;
+    NRF_TIMER1->BITMODE = TIMER_BITMODE_BITMODE_32Bit << TIMER_BITMODE_BITMODE_Pos;
+    NRF_TIMER1->PRESCALER = 4;                                                      // 1 MHz
+    NRF_TIMER1->TASKS_CLEAR = 1;
+    NRF_TIMER1->TASKS_START = 1;
+}
 
 void timer_init(void (*cb)()) 
 {
@@ -33,12 +45,14 @@ void timer_init(void (*cb)())
     NVIC_EnableIRQ(RTC1_IRQn);                                                      // Enable Interrupt for the RTC in the core
     NVIC_SetPriority(RTC1_IRQn, 0);
 
-    // Start RTC
+    // Start RTC and take over from the boot timer
     NRF_RTC1->TASKS_START = 1;
 
-    #ifdef LOG
-    SEGGER_RTT_printf(0, "%u> TIMER: RTC1 started\r\n", timer_get_seconds());
-    #endif    
+    NRF_TIMER1->TASKS_CAPTURE[0] = 1;
+    NRF_TIMER1->TASKS_STOP = 1;
+    boot_ms = NRF_TIMER1->CC[0] / 1000;
+
+    LOG_INFO("TIMER: RTC1 started");
 
     cb(); 
 }
@@ -48,9 +62,7 @@ uint8_t timer_add(void (*cb)(), uint32_t interval)
     // Check if we have slots left in RTC
     if (current_slot == 3) 
     {
-        #ifdef LOG
-        SEGGER_RTT_printf(0, "%u> TIMER: Not slots left in RTC\r\n", timer_get_seconds());
-        #endif    
+        LOG_ERROR("TIMER: Not slots left in RTC");
         return 0xF;
     }
 
@@ -63,30 +75,73 @@ uint8_t timer_add(void (*cb)(), uint32_t interval)
     NRF_RTC1->CC[current_slot] = interval * RTC_FREQUENCY;                 // We use compare 0 for low freq sync    
     NRF_RTC1->INTENSET = 0x1UL << (16UL + current_slot);
 
-    #ifdef LOG
-    SEGGER_RTT_printf(0, "%u> TIMER: Added timer with interval %u to slot %u\r\n", timer_get_seconds(), interval, current_slot);
-    #endif  
+    LOG_INFO("TIMER: Added timer with interval %u to slot %u", interval, current_slot);
     
     current_slot++;
     return current_slot - 1;
 }
 
-RAM_CODE uint32_t timer_get_seconds()
+RAM_CODE(timer_get_ticks) uint32_t timer_get_ticks()
+{
+    return NRF_RTC1->COUNTER + (overflow_seconds * 0xFFFFFF);
+}
+
+uint32_t timer_get_boot_ms()
+{
+    uint32_t ticks = timer_get_ticks();
+    return boot_ms + ((ticks / RTC_FREQUENCY) * 1000) + (((ticks % RTC_FREQUENCY) * 1000) / RTC_FREQUENCY);
+}
+
+RAM_CODE(timer_get_seconds) uint32_t timer_get_seconds()
 {
-    return (NRF_RTC1->COUNTER + (overflow_seconds * 0xFFFFFF)) / RTC_FREQUENCY;
+    return timer_get_ticks() / RTC_FREQUENCY;
 }
 
-RAM_CODE void timer_reschedule(uint8_t slot)
+void timer_trigger(uint8_t slot)
+{
+    if (slot >= current_slot)
+    {
+        return;
+    }
+
+    // Compare has to be at least two ticks ahead of the counter to be caught
+    NRF_RTC1->CC[slot] = NRF_RTC1->COUNTER + 2;
+
+    TRACE_EVENT(TRACE_TIMER_TRIGGER, slot, 0);
+}
+
+void timer_set_interval(uint8_t slot, uint32_t interval)
+{
+    if (slot >= current_slot)
+    {
+        return;
+    }
+
+    // Takes effect when the slot is rescheduled next
+    slots[slot]->interval = interval;
+}
+
+RAM_CODE(timer_reschedule) void timer_reschedule(uint8_t slot)
 {
     timer_def *timer_slot = slots[slot];
     NRF_RTC1->CC[slot] = NRF_RTC1->COUNTER + (timer_slot->interval * RTC_FREQUENCY);
 }
 
-RAM_CODE void RTC1_IRQHandler(void)
+RAM_CODE(RTC1_IRQHandler) void RTC1_IRQHandler(void)
 {
-    #ifdef LOG
-    SEGGER_RTT_printf(0, "%u> TIMER: Interrupt\r\n", timer_get_seconds());
-    #endif
+    ISR_TIMING_ENTER(ISR_RTC1);
+
+    // One record per interrupt, the bit of every compare which fired
+    uint8_t fired = 0;
+    for (uint8_t slot = 0; slot < 3; slot++)
+    {
+        if (NRF_RTC1->EVENTS_COMPARE[slot])
+        {
+            fired |= (1 << slot);
+        }
+    }
+
+    TRACE_EVENT(TRACE_TIMER_IRQ, fired, 0);
 
     // Check if we overflowed
     if (NRF_RTC1->EVENTS_OVRFLW) 
@@ -94,20 +149,14 @@ RAM_CODE void RTC1_IRQHandler(void)
         NRF_RTC1->EVENTS_OVRFLW = 0;
         overflow_seconds++;
 
-        #ifdef LOG
-        SEGGER_RTT_printf(0, "%u> TIMER: Got overflow\r\n", timer_get_seconds());
-        #endif   
+        TRACE_EVENT(TRACE_TIMER_OVERFLOW, 0, 0);
     }
 
     uint8_t counter = 0;
     while(counter < 3)
     {
-        #ifdef LOG
-        SEGGER_RTT_printf(0, "%u> TIMER: Checking interrupt state for compare %u\r\n", timer_get_seconds(), counter);
-        #endif   
-
         // This will trigger every COMPARE_COUNTERTIME seconds
-        if (NRF_RTC1->EVENTS_COMPARE[counter])
+        if (fired & (1 << counter))
         {
             NRF_RTC1->EVENTS_COMPARE[counter] = 0;                                              // Reset interrupt
 
@@ -121,4 +170,6 @@ RAM_CODE void RTC1_IRQHandler(void)
 
         counter++;
     }  
+
+    ISR_TIMING_EXIT(ISR_RTC1);
 }
\ No newline at end of file
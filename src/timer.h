@@ -1,8 +1,20 @@
 #ifndef DOOR_TIMER_H__
 #define DOOR_TIMER_H__
 
+/**
+ * @brief Count the time until RTC1 runs, call this first thing in main()
+ */
+void timer_boot_start(void);
 void timer_init(void (*cb)());
 uint8_t timer_add(void (*cb)(), uint32_t interval);
 uint32_t timer_get_seconds();
+uint32_t timer_get_ticks();
+
+/**
+ * @brief Milliseconds since main() started, the LFCLK start up before RTC1 runs included
+ */
+uint32_t timer_get_boot_ms();
+void timer_trigger(uint8_t slot);
+void timer_set_interval(uint8_t slot, uint32_t interval);
 
 #endif
\ No newline at end of file
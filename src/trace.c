@@ -0,0 +1,65 @@
+#include "nrf.h"
+#include "trace.h"
+#include "log.h"
+#include "compiler.h"
+
+#if defined(TRACE)
+#include "rtt/SEGGER_RTT.h"
+#endif
+
+/*
+ * Formatting text at interrupt priority takes longer than most of the handlers themselves, so
+ * with TRACE the hot paths only copy a 16 byte record into an RTT buffer of its own. The debug
+ * probe reads it in the background, tools/trace_decode.py turns it back into the LOG text.
+ * Records which do not fit are dropped instead of waiting for the probe.
+ *
+ * The timestamp is RTC0, which runs at 32768 Hz for the energy ledger once LFCLK is up.
+ */
+
+#if defined(TRACE)
+
+static uint8_t trace_buffer[TRACE_BUFFER_SIZE];
+static uint16_t sequence = 0;
+
+void trace_init(void)
+{
+    SEGGER_RTT_ConfigUpBuffer(TRACE_CHANNEL, "Trace", trace_buffer, sizeof(trace_buffer), SEGGER_RTT_MODE_NO_BLOCK_SKIP);
+
+    // Decoder checks this against its table
+    trace_event(TRACE_BOOT, TRACE_COUNT, 0);
+}
+
+RAM_CODE(trace_event) void trace_event(trace_id id, uint32_t arg0, uint32_t arg1)
+{
+    trace_record record;
+    record.id = id;
+    record.timestamp = NRF_RTC0->COUNTER;
+    record.args[0] = arg0;
+    record.args[1] = arg1;
+
+    // Deferred jobs trace from thread mode, an interrupt must not write in between
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    record.sequence = sequence++;
+    SEGGER_RTT_WriteSkipNoLock(TRACE_CHANNEL, &record, sizeof(record));
+    __set_PRIMASK(primask);
+}
+
+#else
+
+static const char* const formats[TRACE_COUNT] = {
+#define TRACE_DEF(id, format) format,
+#include "trace_events.h"
+#undef TRACE_DEF
+};
+
+void trace_init(void)
+{
+}
+
+void trace_event(trace_id id, uint32_t arg0, uint32_t arg1)
+{
+    log_printf(formats[id], arg0, arg1);
+}
+
+#endif
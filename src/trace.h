@@ -0,0 +1,47 @@
+#ifndef DOOR_TRACE_H__
+#define DOOR_TRACE_H__
+
+#include "log.h"
+
+#include <stdint.h>
+
+#define TRACE_CHANNEL       1       // RTT up buffer of the binary trace, 0 is the LOG terminal
+#define TRACE_BUFFER_SIZE   512     // 32 records
+
+typedef enum {
+#define TRACE_DEF(id, format) id,
+#include "trace_events.h"
+#undef TRACE_DEF
+    TRACE_COUNT
+} trace_id;
+
+/**
+ * @brief One binary trace record as it goes over RTT, little endian
+ */
+typedef struct {
+    uint16_t id;
+    uint16_t sequence;              // Counts up per record, a gap means the buffer was full
+    uint32_t timestamp;             // RTC0 ticks (30.5us), 24 bit
+    uint32_t args[2];
+} trace_record;
+
+/**
+ * @brief Set up the RTT buffer for the binary trace, first thing in main
+ */
+void trace_init(void);
+
+/**
+ * @brief Record an event. With TRACE this only copies a record into the RTT buffer and drops it
+ * when the buffer is full, otherwise it prints the format from trace_events.h right away.
+ */
+void trace_event(trace_id id, uint32_t arg0, uint32_t arg1);
+
+// TRACE records every event, without it they are LOG_DEBUG lines of the file's LOG_MODULE
+#if defined(TRACE)
+#define TRACE_EVENT(id, arg0, arg1)     trace_event((id), (uint32_t) (arg0), (uint32_t) (arg1))
+#else
+#define TRACE_EVENT(id, arg0, arg1) \
+    do { if (LOG_ENABLED(LOG_MODULE, LOG_LEVEL_DEBUG)) { trace_event((id), (uint32_t) (arg0), (uint32_t) (arg1)); } } while (0)
+#endif
+
+#endif
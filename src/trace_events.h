@@ -0,0 +1,55 @@
+/*
+ * Every trace event with its format, TRACE_DEF(id, format). The position in this list is the
+ * id in the binary records, tools/trace_decode.py reads the formats from here. Formats take up
+ * to two integer arguments and leave out the "seconds>" prefix, the record has a timestamp.
+ *
+ * No include guard, this is included once per use with TRACE_DEF defined.
+ */
+
+TRACE_DEF(TRACE_BOOT,                   "TRACE: Started with %u event types")
+
+TRACE_DEF(TRACE_CLOCK_IRQ,              "CLOCK: Interrupt")
+TRACE_DEF(TRACE_CLOCK_CAL_START,        "CLOCK: Syncing LFCLK against HFCLK")
+TRACE_DEF(TRACE_CLOCK_CAL_DONE,         "CLOCK: Done syncing LFCLK")
+TRACE_DEF(TRACE_CLOCK_LF_STARTED,       "CLOCK: LFCLK started")
+TRACE_DEF(TRACE_CLOCK_HF_STARTED,       "CLOCK: HFCLK started up")
+TRACE_DEF(TRACE_CLOCK_HF_STOPPED,       "CLOCK: HFCLK stopped")
+
+TRACE_DEF(TRACE_TIMER_IRQ,              "TIMER: Interrupt, compare slots 0x%x")
+TRACE_DEF(TRACE_TIMER_OVERFLOW,         "TIMER: Got overflow")
+TRACE_DEF(TRACE_TIMER_TRIGGER,          "TIMER: Triggering slot %u early")
+
+TRACE_DEF(TRACE_BLE_IRQ,                "BLE: Interrupt")
+TRACE_DEF(TRACE_BLE_SEND,               "BLE: Sending data on channel %u")
+TRACE_DEF(TRACE_BLE_EVENT,              "CORE: Got BLE adv timer event")
+TRACE_DEF(TRACE_BLE_HF_READY,           "CORE: HFCLK started. BLE init next")
+TRACE_DEF(TRACE_BLE_RESCHEDULE,         "BLE CB: HFCLK stopped. Telling timer to reschedule")
+TRACE_DEF(TRACE_BLE_SKIP,               "BLE CB: No valid payload, skipping advert")
+TRACE_DEF(TRACE_BLE_FIRST,              "BLE CB: First valid advert after %u ms")
+
+TRACE_DEF(TRACE_AES_IRQ,                "AES: Interrupt")
+TRACE_DEF(TRACE_AES_FULL,               "AES: No job slots left")
+TRACE_DEF(TRACE_AES_QUEUED,             "AES: Queued encryption (%u pending)")
+TRACE_DEF(TRACE_AES_ABORTED,            "AES: ECB aborted, %u jobs wait for the AES core")
+TRACE_DEF(TRACE_AES_CB_NO_KEYSTREAM,    "AES CB: No keystream ready, keeping old payload")
+TRACE_DEF(TRACE_AES_CB_DONE,            "AES CB: Encrypted %u payloads")
+TRACE_DEF(TRACE_AES_CB_BUSY,            "AES CB: Encryption busy, stopping batch after %u payloads")
+TRACE_DEF(TRACE_AES_CB_BATCH,           "AES CB: Encrypting %u payloads starting at %u")
+TRACE_DEF(TRACE_CCM_IRQ,                "CCM: Interrupt")
+TRACE_DEF(TRACE_CCM_START,              "CCM: Start encryption of %u bytes with counter %u")
+TRACE_DEF(TRACE_KEYSTREAM_QUEUED,       "KEYSTREAM: Queued %u blocks")
+TRACE_DEF(TRACE_PAYLOAD_APPLIED,        "PAYLOAD: Applied payload for %u (%u left)")
+
+TRACE_DEF(TRACE_RNG_IRQ,                "RNG: Interrupt")
+TRACE_DEF(TRACE_RNG_SEEDED,             "RNG: Seed complete, %u bytes from RNG since boot. Stopping RNG")
+TRACE_DEF(TRACE_RNG_SHORT,              "RNG: Only %u of %u bytes available")
+TRACE_DEF(TRACE_DRBG_RESEED,            "DRBG: Reseeding")
+
+TRACE_DEF(TRACE_FLASH_FULL,             "FLASH: No queue slots left")
+TRACE_DEF(TRACE_FLASH_DONE,             "FLASH: Op %u done after %u ticks")
+TRACE_DEF(TRACE_KV_SWITCHED,            "KV: Switched to page %u generation %u")
+TRACE_DEF(TRACE_KV_QUEUED,              "KV: Queued %u words for page %u")
+TRACE_DEF(TRACE_EPOCH_CHECKPOINT,       "EPOCH: Checkpoint, reserved up to %u")
+
+TRACE_DEF(TRACE_BATTERY_LEVEL,          "BATTERY: %u mV, using level %u")
+TRACE_DEF(TRACE_MOTION,                 "MOTION: Moving %u")
@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+"""
+Turns the binary trace of a TRACE build back into LOG style text.
+
+Record the RTT channel with the J-Link tools and decode the file afterwards:
+
+    JLinkRTTLogger -Device NRF52832_XXAA -If SWD -Speed 4000 -RTTChannel 1 trace.bin
+    tools/trace_decode.py trace.bin
+
+The event formats come from src/trace_events.h, decode with the sources the firmware was
+built from. Without a file the trace is read from stdin.
+"""
+
+import argparse
+import re
+import struct
+import sys
+from pathlib import Path
+
+RECORD = struct.Struct("<HHIII")        # id, sequence, timestamp, arg0, arg1
+RTC_HZ = 32768
+RTC_WRAP = 1 << 24
+
+EVENTS = Path(__file__).resolve().parent.parent / "src" / "trace_events.h"
+
+
+def load_events(path):
+    events = []
+    for match in re.finditer(r'^TRACE_DEF\(\s*(\w+)\s*,\s*"((?:[^"\\]|\\.)*)"\s*\)', path.read_text(), re.M):
+        name, fmt = match.groups()
+        events.append((name, fmt, len(re.findall(r"%[-0-9]*[a-zA-Z]", fmt.replace("%%", "")))))
+    return events
+
+
+def decode(stream, events, out):
+    ticks = 0
+    last_timestamp = None
+    last_sequence = None
+    lost = 0
+
+    while True:
+        data = stream.read(RECORD.size)
+        if len(data) < RECORD.size:
+            break
+
+        event, sequence, timestamp, arg0, arg1 = RECORD.unpack(data)
+
+        if event < len(events) and events[event][0] == "TRACE_BOOT":
+            # Restarted, sequence numbers and timestamps begin again
+            ticks = 0
+            last_timestamp = None
+            last_sequence = None
+
+        if last_sequence is not None and sequence != (last_sequence + 1) & 0xFFFF:
+            missing = (sequence - last_sequence - 1) & 0xFFFF
+            lost += missing
+            out.write("-- %u records lost, RTT buffer was full\n" % missing)
+        last_sequence = sequence
+
+        if last_timestamp is not None:
+            ticks += (timestamp - last_timestamp) % RTC_WRAP
+        last_timestamp = timestamp
+
+        if event >= len(events):
+            out.write("%u.%03u> Unknown event %u (%u, %u)\n" % (ticks // RTC_HZ, ticks % RTC_HZ * 1000 // RTC_HZ, event, arg0, arg1))
+            continue
+
+        name, fmt, count = events[event]
+        text = fmt % (arg0, arg1)[:count]
+        out.write("%u.%03u> %s\n" % (ticks // RTC_HZ, ticks % RTC_HZ * 1000 // RTC_HZ, text))
+
+        if name == "TRACE_BOOT":
+            if arg0 != len(events):
+                out.write("-- Firmware has %u event types, %s has %u, decode with matching sources\n" % (arg0, EVENTS.name, len(events)))
+
+    return lost
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("trace", nargs="?", help="binary trace from RTT channel 1, stdin if left out")
+    parser.add_argument("--events", default=EVENTS, type=Path, help="trace_events.h to take the formats from")
+    args = parser.parse_args()
+
+    events = load_events(args.events)
+    if not events:
+        sys.exit("No TRACE_DEF entries in %s" % args.events)
+
+    if args.trace:
+        with open(args.trace, "rb") as stream:
+            lost = decode(stream, events, sys.stdout)
+    else:
+        lost = decode(sys.stdin.buffer, events, sys.stdout)
+
+    if lost:
+        sys.stderr.write("%u records lost in total\n" % lost)
+
+
+if __name__ == "__main__":
+    main()